@@ -12,6 +12,7 @@ void skip_to_EOR(FILE *fp) {
 
 call_t read_call(FILE *fp) {
     call_t call;
+    call.st = 0;
 
     long long n;
     float avg_qspan;
@@ -30,18 +31,29 @@ call_t read_call(FILE *fp) {
     call.max_dist_x = max_dist_x;
     call.max_dist_y = max_dist_y;
     call.bw = bw;
+    // --max-chain-skip and --max-chain-iter; dumps written before these were
+    // recorded end the header line after bw
+    char line[64];
+    call.max_skip = 0, call.max_iter = 64;
+    if (fgets(line, sizeof(line), fp))
+        sscanf(line, "%d%d", &call.max_skip, &call.max_iter);
+    static bool warned = false;
+    if (!warned && (call.max_skip > 0 || call.max_iter != 64)) {
+        fprintf(stderr, "WARNING: the device kernel does not implement chaining pruning; "
+                "max_skip=%d max_iter=%d ignored\n", call.max_skip, call.max_iter);
+        warned = true;
+    }
 
-    call.anchors.resize(call.n);
+    call.tags.resize(call.n);
+    call.xs.resize(call.n);
+    call.ws.resize(call.n);
+    call.ys.resize(call.n);
 
     for (anchor_idx_t i = 0; i < call.n; i++) {
         unsigned int tag;
         int x, w, y;
         fscanf(fp, "%u%d%d%d", &tag, &x, &w, &y);
-
-        anchor_t t;
-        t.tag = tag; t.x = x; t.w = w; t.y = y;
-
-        call.anchors[i] = t;
+        call.tags[i] = tag; call.xs[i] = x; call.ws[i] = w; call.ys[i] = y;
     }
 
     skip_to_EOR(fp);
@@ -6,21 +6,21 @@
 #include "host_data_io.h"
 
 
-anchor_dt format_anchor(anchor_t curr, bool init, int pe_num)
+anchor_dt format_anchor(const call_t &call, anchor_idx_t i, bool init, int pe_num)
 {
     anchor_dt temp;
 
     static std::vector<tag_t>  pre_tag(PE_NUM);
     static std::vector<tag_dt> tag_compressed(PE_NUM);
 
-    if (curr.tag != pre_tag[pe_num] || init) {
+    if (call.tags[i] != pre_tag[pe_num] || init) {
         tag_compressed[pe_num] = tag_compressed[pe_num] + 1;
     }
-    pre_tag[pe_num] = curr.tag;
+    pre_tag[pe_num] = call.tags[i];
 
-    temp.x = (loc_dt)curr.x;
-    temp.y = (loc_dt)curr.y;
-    temp.w = (width_dt)curr.w;
+    temp.x = (loc_dt)call.xs[i];
+    temp.y = (loc_dt)call.ys[i];
+    temp.w = (width_dt)call.ws[i];
     temp.tag = tag_compressed[pe_num];
 
     return temp;
@@ -75,20 +75,15 @@ void scheduler(FILE *in,
             }
 
             for (int j = 0; j < TILE_SIZE_ACTUAL; j++) {
-                if ((unsigned)j < calls[i].anchors.size()) {
-                    data.push_back(format_anchor(calls[i].anchors[j],
+                if (calls[i].st + j < calls[i].n) {
+                    data.push_back(format_anchor(calls[i], calls[i].st + j,
                             pe_controls[i].tile_num == 0 && j == 0, i));
                 } else data.push_back(anchor_dt());
             }
 
-            if (calls[i].anchors.size() > (unsigned)TILE_SIZE) {
-                calls[i].anchors.erase(calls[i].anchors.begin(),
-                    calls[i].anchors.begin() + TILE_SIZE);
-            } else {
-                calls[i].anchors.clear();
-            }
+            calls[i].st += TILE_SIZE;
 
-            if (calls[i].anchors.empty()) {
+            if (calls[i].st >= calls[i].n) {
                 if (curr_read_id > read_batch_size) {
                     calls[i].n = ANCHOR_NULL;
                     continue;
@@ -42,7 +42,12 @@ struct call_t {
     anchor_idx_t n;
     qspan_t avg_qspan;
     int max_dist_x, max_dist_y, bw;
-    std::vector<anchor_t> anchors;
+    int max_skip, max_iter;
+    // anchors in the SoA layout of the chain dump; [st,n) are not scheduled yet
+    std::vector<tag_t> tags;
+    std::vector<loc_t> xs, ys;
+    std::vector<width_t> ws;
+    anchor_idx_t st;
 };
 
 struct return_t {
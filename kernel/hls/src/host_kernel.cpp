@@ -28,7 +28,7 @@ void host_chain_kernel(const call_t &arg, return_t &ret)
     std::vector<loc_t>   j_tracker(BACK_SEARCH_COUNT, 0);
 
     for (anchor_idx_t i = 0; i < arg.n; i++) {
-        anchor_t curr = arg.anchors[i];
+        anchor_t curr = {arg.tags[i], arg.xs[i], arg.ws[i], arg.ys[i]};
 
         score_t max_f = max_tracker[i % BACK_SEARCH_COUNT];
         loc_t   max_j = j_tracker[i % BACK_SEARCH_COUNT];
@@ -47,7 +47,7 @@ void host_chain_kernel(const call_t &arg, return_t &ret)
         for (anchor_idx_t j = i + 1, row = 1;
                 j < arg.n && row < BACK_SEARCH_COUNT;
                 j++, row++) {
-            anchor_t next = arg.anchors[j];
+            anchor_t next = {arg.tags[j], arg.xs[j], arg.ws[j], arg.ys[j]};
 
             loc_dist_t dist_x = next.x - curr.x;
             loc_dist_t dist_y = next.y - curr.y;
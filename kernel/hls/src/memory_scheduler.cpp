@@ -6,7 +6,7 @@
 #include "CL/opencl.h"
 
 
-anchor_dt format_anchor(anchor_t curr, bool init,
+anchor_dt format_anchor(const call_t &call, anchor_idx_t i, bool init,
         bool backup, bool restore, int pe_num)
 {
     anchor_dt temp = 0;
@@ -22,21 +22,21 @@ anchor_dt format_anchor(anchor_t curr, bool init,
         pre_tag[pe_num] = backup_tag[pe_num];
     }
 
-    if (curr.tag != pre_tag[pe_num] || init) {
+    if (call.tags[i] != pre_tag[pe_num] || init) {
         tag_compressed[pe_num] = tag_compressed[pe_num] + 1;
     }
-    pre_tag[pe_num] = curr.tag;
+    pre_tag[pe_num] = call.tags[i];
 
     temp |= anchor_dt(tag_compressed[pe_num]);
     temp <<= 16;
 
-    temp |= anchor_dt((loc_dt)curr.x);
+    temp |= anchor_dt((loc_dt)call.xs[i]);
     temp <<= 16;
 
-    temp |= anchor_dt((width_dt)curr.w);
+    temp |= anchor_dt((width_dt)call.ws[i]);
     temp <<= 16;
 
-    temp |= anchor_dt((loc_dt)curr.y);
+    temp |= anchor_dt((loc_dt)call.ys[i]);
 
     return temp;
 }
@@ -121,24 +121,19 @@ void scheduler(FILE *in,
             }
 
             for (int j = 0; j < TILE_SIZE + BACK_SEARCH_COUNT; j++) {
-                if ((unsigned)j < calls[i].anchors.size()) {
+                if (calls[i].st + j < calls[i].n) {
                     bool backup = j == TILE_SIZE;
                     bool restore = tile_num[i] != 0 && j == 0;
                     temp_data[i].push_back(
-                        format_anchor(calls[i].anchors[j],
+                        format_anchor(calls[i], calls[i].st + j,
                             tile_num[i] == 0 && j == 0,
                             backup, restore, i));
                 } else temp_data[i].push_back(0);
             }
 
-            if (calls[i].anchors.size() > (unsigned)TILE_SIZE) {
-                calls[i].anchors.erase(calls[i].anchors.begin(),
-                    calls[i].anchors.begin() + TILE_SIZE);
-            } else {
-                calls[i].anchors.clear();
-            }
+            calls[i].st += TILE_SIZE;
 
-            if (calls[i].anchors.empty()) {
+            if (calls[i].st >= calls[i].n) {
                 if (curr_read_id >= read_batch_size) { // ">" will results in read_batch_size+1 reads
                     calls[i].n = ANCHOR_NULL;
                     continue;
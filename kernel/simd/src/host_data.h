@@ -13,18 +13,13 @@ typedef int32_t parent_t;
 
 #define ANCHOR_NULL (anchor_idx_t)(-1)
 
-struct anchor_t {
-    tag_t   tag;
-    loc_t   x;
-    score_t w;
-    loc_t   y;
-};
-
 struct call_t {
     anchor_idx_t n;
     float avg_qspan;
     int max_dist_x, max_dist_y, bw;
-    std::vector<anchor_t> anchors;
+    int max_skip, max_iter;
+    // anchors in the SoA layout of the chain dump, padded with
+    // BACK_SEARCH_COUNT + 1 zero anchors and aligned to 64 bytes
     tag_t *tags;
     loc_t *xs;
     score_t *ws;
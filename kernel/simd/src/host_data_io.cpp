@@ -1,5 +1,8 @@
+#include <cstdlib>
+#include <cstring>
 #include "host_data_io.h"
 #include "host_data.h"
+#include "common.h"
 
 void skip_to_EOR(FILE *fp) {
     const char *loc = "EOR";
@@ -30,18 +33,27 @@ call_t read_call(FILE *fp) {
     call.max_dist_x = max_dist_x;
     call.max_dist_y = max_dist_y;
     call.bw = bw;
+    // --max-chain-skip and --max-chain-iter; dumps written before these were
+    // recorded end the header line after bw
+    char line[64];
+    call.max_skip = 0, call.max_iter = 64;
+    if (fgets(line, sizeof(line), fp))
+        sscanf(line, "%d%d", &call.max_skip, &call.max_iter);
 
-    call.anchors.resize(call.n);
+    size_t size = (call.n + BACK_SEARCH_COUNT + 1) * sizeof(int32_t);
+    size = (size + 63) / 64 * 64;
+    call.tags = (tag_t *)aligned_alloc(64, size);
+    call.xs = (loc_t *)aligned_alloc(64, size);
+    call.ws = (score_t *)aligned_alloc(64, size);
+    call.ys = (loc_t *)aligned_alloc(64, size);
+    memset(call.tags, 0, size); memset(call.xs, 0, size);
+    memset(call.ws, 0, size); memset(call.ys, 0, size);
 
     for (anchor_idx_t i = 0; i < call.n; i++) {
         unsigned int tag;
         int x, w, y;
         fscanf(fp, "%u%d%d%d", &tag, &x, &w, &y);
-
-        anchor_t t;
-        t.tag = tag; t.x = x; t.w = w; t.y = y;
-
-        call.anchors[i] = t;
+        call.tags[i] = tag; call.xs[i] = x; call.ws[i] = w; call.ys[i] = y;
     }
 
     skip_to_EOR(fp);
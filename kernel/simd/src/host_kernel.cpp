@@ -18,24 +18,52 @@ static inline int32_t ilog2_32(uint32_t v)
     else return 8;
 }
 
+// The "forward" kernel below pushes each score to a fixed window of successors
+// and cannot stop early, so calls dumped with --max-chain-skip or a non-default
+// --max-chain-iter are chained by this scalar "backward" loop, as in the testbed.
+static void chain_backward(const call_t &arg, return_t &ret)
+{
+    score_t  *f = ret.scores.data();
+    parent_t *p = ret.parents.data();
+    std::vector<int32_t> t(arg.n, 0);
+
+    for (int32_t i = 0; i < arg.n; i++) {
+        score_t max_f = arg.ws[i];
+        parent_t max_j = -1;
+        int32_t n_skip = 0;
+        for (int32_t j = i - 1; j >= 0 && j >= i - arg.max_iter; j--) {
+            if (arg.tags[j] != arg.tags[i]) break;
+            loc_dist_t dist_x = arg.xs[i] - arg.xs[j];
+            if (dist_x > arg.max_dist_x) break;
+            loc_dist_t dist_y = arg.ys[i] - arg.ys[j];
+            if (dist_x == 0 || dist_y <= 0) continue;
+            if (dist_y > arg.max_dist_y) continue;
+            loc_dist_t dd = dist_x > dist_y ? dist_x - dist_y : dist_y - dist_x;
+            if (dd > arg.bw) continue;
+            loc_dist_t min_d = dist_y < dist_x ? dist_y : dist_x;
+            score_t sc = min_d > arg.ws[i] ? arg.ws[i] : min_d;
+            int32_t log_dd = dd ? ilog2_32((uint32_t)dd) : 0;
+            sc -= (score_t)(dd * 0.01 * arg.avg_qspan) + (log_dd >> 1);
+            sc += f[j];
+            if (sc > max_f) {
+                max_f = sc; max_j = j;
+                if (n_skip > 0) n_skip--;
+            } else if (arg.max_skip > 0 && t[j] == i) {
+                if (++n_skip > arg.max_skip) break;
+            }
+            if (p[j] >= 0) t[p[j]] = i;
+        }
+        f[i] = max_f; p[i] = max_j;
+    }
+}
+
 void host_chain_kernel(std::vector<call_t> &args, std::vector<return_t> &rets)
 {
 #pragma omp parallel for schedule(guided)
     for (size_t i = 0; i < args.size(); i++) {
-        args[i].anchors.resize(args[i].n + BACK_SEARCH_COUNT);
-        args[i].xs = (loc_t *)aligned_alloc(64, sizeof(loc_t) * (args[i].n + BACK_SEARCH_COUNT) + 64);
-        args[i].ys = (loc_t *)aligned_alloc(64, sizeof(loc_t) * (args[i].n + BACK_SEARCH_COUNT) + 64);
-        args[i].ws = (score_t *)aligned_alloc(64, sizeof(score_t) * (args[i].n + BACK_SEARCH_COUNT) + 64);
-        args[i].tags = (tag_t *)aligned_alloc(64, sizeof(tag_t) * (args[i].n + BACK_SEARCH_COUNT) + 64);
         rets[i].n = args[i].n;
         rets[i].scores.resize(rets[i].n + BACK_SEARCH_COUNT);
         rets[i].parents.resize(rets[i].n + BACK_SEARCH_COUNT);
-        for (int32_t j = 0; j < args[i].n; j++) {
-            args[i].xs[j] = args[i].anchors[j].x;
-            args[i].ys[j] = args[i].anchors[j].y;
-            args[i].ws[j] = args[i].anchors[j].w;
-            args[i].tags[j] = args[i].anchors[j].tag;
-        }
     }
 
     struct timespec start, end;
@@ -45,6 +73,10 @@ void host_chain_kernel(std::vector<call_t> &args, std::vector<return_t> &rets)
     for (size_t batch = 0; batch < args.size(); batch++) {
         auto &arg = args[batch];
         auto &ret = rets[batch];
+        if (arg.max_skip > 0 || arg.max_iter != BACK_SEARCH_COUNT - 1) {
+            chain_backward(arg, ret);
+            continue;
+        }
         score_t  *f = ret.scores.data();
         parent_t *p = ret.parents.data();
 
@@ -3,8 +3,8 @@
 #include "host_data_io.h"
 #include "memory_scheduler.h"
 
-anchor_dt compress_anchor(anchor_t curr, bool init, bool backup, bool restore,
-                          int pe_num) {
+anchor_dt compress_anchor(const call_t &call, anchor_idx_t i, bool init,
+                          bool backup, bool restore, int pe_num) {
   static tag_t pre_tag[PE_NUM];
   static tag_t backup_tag[PE_NUM];
   static tag_dt tag_compressed[PE_NUM];
@@ -14,15 +14,15 @@ anchor_dt compress_anchor(anchor_t curr, bool init, bool backup, bool restore,
   else if (restore)
     pre_tag[pe_num] = backup_tag[pe_num];
 
-  if (curr.tag != pre_tag[pe_num] || init)
+  if (call.tags[i] != pre_tag[pe_num] || init)
     tag_compressed[pe_num] = tag_compressed[pe_num] + 1;
-  pre_tag[pe_num] = curr.tag;
+  pre_tag[pe_num] = call.tags[i];
 
   anchor_dt temp;
   temp.tag = tag_compressed[pe_num];
-  temp.x = curr.x;
-  temp.y = curr.y;
-  temp.w = curr.w;
+  temp.x = call.xs[i];
+  temp.y = call.ys[i];
+  temp.w = call.ws[i];
   return temp;
 }
 
@@ -80,24 +80,20 @@ void scheduler(FILE *in, std::vector<anchor_dt> &anchors,
 
       // fill in the anchor data
       for (int block = 0; block < BATCH_SIZE_INPUT; block++) {
-        if ((unsigned)block < calls[pe].anchors.size()) {
+        if (calls[pe].st + block < calls[pe].n) {
           bool init = batch_num[pe] == 0 && block == 0;
           bool backup = block == BATCH_SIZE_OUTPUT;
           bool restore = batch_num[pe] != 0 && block == 0;
-          batch_data[pe].push_back(compress_anchor(calls[pe].anchors[block],
-                                                   init, backup, restore, pe));
+          batch_data[pe].push_back(compress_anchor(
+              calls[pe], calls[pe].st + block, init, backup, restore, pe));
         } else
           batch_data[pe].push_back(anchor_dt());
       }
 
-      // remove the filled anchors from the original call
-      if (calls[pe].anchors.size() > (unsigned)BATCH_SIZE_OUTPUT)
-        calls[pe].anchors.erase(calls[pe].anchors.begin(),
-                                calls[pe].anchors.begin() + BATCH_SIZE_OUTPUT);
-      else
-        calls[pe].anchors.clear();
+      // skip the filled anchors of the call
+      calls[pe].st += BATCH_SIZE_OUTPUT;
 
-      if (calls[pe].anchors.empty()) {
+      if (calls[pe].st >= calls[pe].n) {
         // if the call is finished, read in a new call
         calls[pe] = read_call(in);
         ns.push_back(calls[pe].n);
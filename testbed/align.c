@@ -5,6 +5,7 @@
 #include "minimap.h"
 #include "mmpriv.h"
 #include "ksw2.h"
+#include "kthread.h"
 
 static void ksw_gen_simple_mat(int m, int8_t *mat, int8_t a, int8_t b, int8_t sc_ambi)
 {
@@ -290,8 +291,12 @@ static void mm_update_cigar_eqx(mm_reg1_t *r, const uint8_t *qseq, const uint8_t
 	r->p = p;
 }
 
+#define MM_ALN_WFA 0x10000 // mm_align_pair() only: try WFA before DP; not passed to ksw
+
 static void mm_align_pair(void *km, mm_mapopt_t *opt, int qlen, const uint8_t *qseq, int tlen, const uint8_t *tseq, const int8_t *mat, int w, int end_bonus, int zdrop, int flag, ksw_extz_t *ez)
 {
+	int use_wfa = (flag & MM_ALN_WFA) && !(flag & KSW_EZ_EXTZ_ONLY) && !(opt->flag & MM_F_SPLICE);
+	flag &= ~MM_ALN_WFA;
 	if (mm_dbg_flag & MM_DBG_PRINT_ALN_SEQ) {
 		int i;
 		fprintf(stderr, "===> q=(%d,%d), e=(%d,%d), bw=%d, flag=%d, zdrop=%d <===\n", opt->q, opt->q2, opt->e, opt->e2, w, flag, opt->zdrop);
@@ -300,7 +305,21 @@ static void mm_align_pair(void *km, mm_mapopt_t *opt, int qlen, const uint8_t *q
 		for (i = 0; i < qlen; ++i) fputc("ACGTN"[qseq[i]], stderr);
 		fputc('\n', stderr);
 	}
-	if (opt->flag & MM_F_SPLICE)
+	if (use_wfa) {
+		// WFA visits about pen^2/e' cells, where e' is the smaller of the converted gap extension penalties. Give up before that
+		// exceeds 1/64 of the DP band, or at about twice the edits expected at the divergence threshold.
+		int max_len = qlen > tlen? qlen : tlen, band = w < 0 || 2 * w + 1 > qlen? qlen : 2 * w + 1, max_pen, pen_dp;
+		int e_min = opt->e < opt->e2? opt->e : opt->e2;
+		max_pen = (8 + (int)(max_len * opt->max_wfa_div * 2.0f)) * 2 * (opt->a + opt->b);
+		pen_dp = (int)sqrt((2.0 * e_min + opt->a) * tlen * band / 64.0);
+		if (max_pen > pen_dp) max_pen = pen_dp;
+		use_wfa = ksw_wfa(km, qlen, qseq, tlen, tseq, 5, mat, opt->q, opt->e, opt->q2, opt->e2, max_pen, flag, ez);
+		if (use_wfa && mm_test_zdrop(km, opt, qseq, tseq, ez->n_cigar, ez->cigar, mat) != 0)
+			use_wfa = 0; // leave it to DP to decide where to Z-drop
+	}
+	if (use_wfa) {
+		// done; no Z-drop along the path, so DP would not drop either
+	} else if (opt->flag & MM_F_SPLICE)
 		ksw_exts2_sse(km, qlen, qseq, tlen, tseq, 5, mat, opt->q, opt->e, opt->q2, opt->noncan, zdrop, flag, ez);
 	else if (opt->q == opt->q2 && opt->e == opt->e2)
 		ksw_extz2_sse(km, qlen, qseq, tlen, tseq, 5, mat, opt->q, opt->e, w, zdrop, end_bonus, flag, ez);
@@ -341,6 +360,243 @@ static inline void mm_adjust_minier(const mm_idx_t *mi, uint8_t *const qseq0[2],
 	}
 }
 
+// Global edit distance with the bit-parallel algorithm of Myers (1999), processing the query in 64-base blocks as in Hyyro (2003).
+// Neither sequence may contain ambiguous bases.
+static int mm_edit_dist(void *km, int qlen, const uint8_t *qseq, int tlen, const uint8_t *tseq)
+{
+	int32_t i, j, nb = (qlen + 63) >> 6, d = qlen;
+	uint64_t *peq, *P, *M;
+	peq = (uint64_t*)kcalloc(km, nb * 6, sizeof(uint64_t));
+	P = peq + nb * 4, M = P + nb;
+	for (i = 0; i < qlen; ++i)
+		peq[qseq[i] * nb + (i>>6)] |= 1ULL << (i&63);
+	for (i = 0; i < nb; ++i) P[i] = ~0ULL; // D(i,0) = i
+	for (j = 0; j < tlen; ++j) {
+		const uint64_t *eq = &peq[tseq[j] * nb];
+		int32_t h = 1; // D(0,j) = j
+		for (i = 0; i < nb; ++i) {
+			uint64_t Eq = eq[i], Pv = P[i], Mv = M[i], Xv, Xh, Ph, Mh;
+			int32_t sh = i < nb - 1? 63 : (qlen - 1) & 63, hout;
+			Xv = Eq | Mv;
+			if (h < 0) Eq |= 1;
+			Xh = (((Eq & Pv) + Pv) ^ Pv) | Eq;
+			Ph = Mv | ~(Xh | Pv);
+			Mh = Pv & Xh;
+			hout = (int32_t)(Ph >> sh & 1) - (int32_t)(Mh >> sh & 1);
+			Ph <<= 1, Mh <<= 1;
+			if (h < 0) Mh |= 1;
+			else if (h > 0) Ph |= 1;
+			P[i] = Mh | ~(Xv | Ph);
+			M[i] = Ph & Xv;
+			h = hout;
+		}
+		d += h;
+	}
+	kfree(km, peq);
+	return d;
+}
+
+// Test if an ungapped alignment with _h_ mismatches scores higher than any gapped alignment of the same sequences, given that
+// the edit distance is at least _d_. A gapped alignment with k insertions (and thus k deletions) has at least max(d-2k,0)
+// mismatches, at most L-k matches, and one gap of each type.
+static int mm_ungapped_is_best(const mm_mapopt_t *opt, int h, int d)
+{
+	int k, sc = -h * (opt->a + opt->b); // relative to the score of an exact match
+	if (h * opt->b > opt->zdrop) return 0; // DP may Z-drop
+	for (k = 1;; ++k) {
+		int mm = d - 2 * k > 0? d - 2 * k : 0, g1 = opt->q + opt->e * k, g2 = opt->q2 + opt->e2 * k;
+		if (-k * opt->a - mm * (opt->a + opt->b) - 2 * (g1 < g2? g1 : g2) >= sc) return 0;
+		if (mm == 0) return 1; // the bound only decreases from here
+	}
+}
+
+// Score of the ungapped alignment of a gap between two anchors if it is the unique optimal alignment, or KSW_NEG_INF
+static int mm_ungapped_score(void *km, const mm_mapopt_t *opt, int qlen, const uint8_t *qseq, int tlen, const uint8_t *tseq)
+{
+	int32_t i, h = 0;
+	if (qlen != tlen || qlen == 0) return KSW_NEG_INF;
+	for (i = 0; i + 8 <= qlen; i += 8) { // 8 bases at a time
+		uint64_t x, y, z;
+		memcpy(&x, &qseq[i], 8);
+		memcpy(&y, &tseq[i], 8);
+		if ((x | y) & 0x0404040404040404ULL) return KSW_NEG_INF; // ambiguous bases
+		if ((z = x ^ y) == 0) continue;
+		z = (z | z >> 1) & 0x0101010101010101ULL;
+		for (; z; z &= z - 1) ++h;
+		if (!mm_ungapped_is_best(opt, h, h)) return KSW_NEG_INF;
+	}
+	for (; i < qlen; ++i) {
+		if (qseq[i] > 3 || tseq[i] > 3) return KSW_NEG_INF;
+		h += qseq[i] != tseq[i];
+	}
+	if (!mm_ungapped_is_best(opt, h, 0)) { // mismatches alone don't settle it; check the edit distance
+		if (!mm_ungapped_is_best(opt, h, h) || !mm_ungapped_is_best(opt, h, mm_edit_dist(km, qlen, qseq, tlen, tseq)))
+			return KSW_NEG_INF;
+	}
+	return (qlen - h) * opt->a - h * opt->b;
+}
+
+#define MM_GFILL_MAX_LEN   48     // gaps up to this length on both sequences are filled in batches
+#define MM_GFILL_MIN_BATCH 8
+#define MM_ALN_PAR_MIN_LEN 100000 // only align the regions or gaps of a query in parallel if it is at least this long
+
+typedef struct { // each strand of a query reversed; built once per query and read by all left extensions of it
+	uint8_t *rev[2]; // rev[s][i] = qseq0[s][qlen-1-i]
+} mm_qprof_t;
+
+#define MM_REF_CACHE_N 4 // number of decoded reference windows kept by each thread
+
+typedef struct {
+	int32_t rid, st, en;
+	uint8_t *seq;
+} mm_refwin_t;
+
+typedef struct { // recently decoded reference windows; private to a thread and a query
+	int n, i; // number of windows; the window to replace next
+	mm_refwin_t w[MM_REF_CACHE_N];
+} mm_refcache_t;
+
+// Return reference bases [st,en) of sequence _rid_, decoding them only if they are not in a cached window. The returned
+// pointer is valid until MM_REF_CACHE_N more windows are decoded.
+static const uint8_t *mm_refcache_get(void *km, mm_refcache_t *c, const mm_idx_t *mi, int32_t rid, int32_t st, int32_t en)
+{
+	int k;
+	mm_refwin_t *w;
+	for (k = 0; k < c->n; ++k) {
+		w = &c->w[k];
+		if (w->rid == rid && w->st <= st && en <= w->en)
+			return &w->seq[st - w->st];
+	}
+	if (c->n < MM_REF_CACHE_N) w = &c->w[c->n++];
+	else w = &c->w[c->i], c->i = (c->i + 1) % MM_REF_CACHE_N, kfree(km, w->seq);
+	w->rid = rid, w->st = st, w->en = en;
+	w->seq = (uint8_t*)kmalloc(km, en - st);
+	mm_idx_getseq(mi, rid, st, en, w->seq);
+	return w->seq;
+}
+
+static void mm_refcache_destroy(void *km, mm_refcache_t *c)
+{
+	int k;
+	for (k = 0; k < c->n; ++k) kfree(km, c->w[k].seq);
+	c->n = c->i = 0;
+}
+
+typedef struct {
+	int n_gap, n, n_par; // number of gaps to fill; number of gaps filled in the batch; number of gaps filled in parallel
+	int32_t *idx;        // idx[i]: index in b[] of the i-th gap, or -1
+	int32_t *pidx;       // pidx[i]: index in ez[] of the i-th gap, or -1
+	ksw_ggb_t *b;
+	ksw_extz_t *ez;      // CIGARs allocated with malloc()
+} mm_gfill_t;
+
+typedef struct {
+	mm_mapopt_t *opt;
+	const int8_t *mat;
+	int32_t rs0, extra_flag;
+	const uint8_t *qseq, *ref; // _ref_ holds the reference from _rs0_
+	const int32_t *coor, *task; // coor[5*i..5*i+4]: qs, qe, rs, re and band width of the i-th gap; task[k]: the gap of the k-th task
+	void **km;                  // one per thread
+	ksw_extz_t *ez;
+} mm_gfill_par_t;
+
+static void gfill_par_worker(void *data, long k, int tid) // kt_for() callback
+{
+	mm_gfill_par_t *p = (mm_gfill_par_t*)data;
+	const int32_t *c = &p->coor[p->task[k] * 5];
+	void *km = p->km[tid];
+	ksw_extz_t *ez = &p->ez[k];
+	uint32_t *cigar = 0;
+	mm_align_pair(km, p->opt, c[1] - c[0], &p->qseq[c[0]], c[3] - c[2], &p->ref[c[2] - p->rs0], p->mat, c[4], -1, p->opt->zdrop, p->extra_flag|KSW_EZ_APPROX_MAX, ez);
+	if (ez->n_cigar > 0) { // move the CIGAR out of the thread-local pool
+		cigar = (uint32_t*)malloc(ez->n_cigar * 4);
+		memcpy(cigar, ez->cigar, ez->n_cigar * 4);
+	}
+	kfree(km, ez->cigar);
+	ez->cigar = cigar, ez->m_cigar = ez->n_cigar;
+}
+
+// Perform the first pass of the gap-filling loop in mm_align1() ahead of the loop. Short gaps are aligned in SIMD batches; with
+// multiple threads, the rest are aligned in parallel. Gaps are visited in the same order as in the loop. _ref_ holds the
+// decoded reference from _rs0_.
+static void mm_gfill_first_pass(void *km, mm_mapopt_t *opt, const mm_idx_t *mi, uint8_t *qseq0[2], const uint8_t *ref, int32_t rs0, mm128_t *a,
+								int as1, int cnt1, int32_t rs, int32_t qs, int bw, const int8_t *mat, int extra_flag, int n_threads, mm_gfill_t *g)
+{
+	int32_t i, re, qe, rev = a[as1].x>>63, *coor;
+	uint64_t *srt;
+	memset(g, 0, sizeof(mm_gfill_t));
+	g->idx = (int32_t*)kmalloc(km, cnt1 * sizeof(int32_t));
+	coor = (int32_t*)kmalloc(km, cnt1 * 5 * sizeof(int32_t));
+	srt = (uint64_t*)kmalloc(km, cnt1 * sizeof(uint64_t));
+	for (i = 1; i < cnt1; ++i) {
+		if ((a[as1+i].y & (MM_SEED_IGNORE|MM_SEED_TANDEM)) && i != cnt1 - 1) continue;
+		mm_adjust_minier(mi, qseq0, &a[as1 + i], &re, &qe);
+		if (i == cnt1 - 1 || (a[as1+i].y&MM_SEED_LONG_JOIN) || (qe - qs >= opt->min_ksw_len && re - rs >= opt->min_ksw_len)) {
+			int32_t ql = qe - qs, tl = re - rs, bw1 = bw, max_len = ql > tl? ql : tl, *c = &coor[g->n_gap * 5];
+			if (a[as1+i].y & MM_SEED_LONG_JOIN)
+				bw1 = max_len;
+			c[0] = qs, c[1] = qe, c[2] = rs, c[3] = re, c[4] = bw1;
+			g->idx[g->n_gap] = -1;
+			if (!(opt->flag & MM_F_SPLICE) && ql > 0 && tl > 0 && max_len <= MM_GFILL_MAX_LEN && bw1 >= max_len) // the band doesn't matter
+				srt[g->n++] = (uint64_t)max_len<<32 | g->n_gap;
+			++g->n_gap;
+			rs = re, qs = qe;
+		}
+	}
+	if (g->n >= MM_GFILL_MIN_BATCH) {
+		radix_sort_64(srt, srt + g->n); // put gaps of similar sizes in the same SIMD batch
+		g->b = (ksw_ggb_t*)kcalloc(km, g->n, sizeof(ksw_ggb_t));
+		for (i = 0; i < g->n; ++i) {
+			int32_t *c = &coor[(int32_t)srt[i] * 5];
+			ksw_ggb_t *p = &g->b[i];
+			g->idx[(int32_t)srt[i]] = i;
+			p->qlen = c[1] - c[0], p->query = &qseq0[rev][c[0]];
+			p->tlen = c[3] - c[2], p->target = &ref[c[2] - rs0];
+		}
+		ksw_gg_batch_sse(km, g->n, g->b, 5, mat, opt->q, opt->e, opt->q2, opt->e2);
+	} else { // too few to fill a batch
+		for (i = 0; i < g->n; ++i) g->idx[(int32_t)srt[i]] = -1;
+		g->n = 0;
+	}
+	if (n_threads > 1) {
+		mm_gfill_par_t p;
+		int32_t *task = (int32_t*)srt; // reuse the memory
+		g->pidx = (int32_t*)kmalloc(km, g->n_gap * sizeof(int32_t));
+		for (i = 0; i < g->n_gap; ++i) {
+			int32_t *c = &coor[i * 5];
+			g->pidx[i] = -1;
+			if (g->idx[i] < 0 && c[1] > c[0] && c[3] > c[2])
+				g->pidx[i] = g->n_par, task[g->n_par++] = i;
+		}
+		if (g->n_par >= 2) {
+			memset(&p, 0, sizeof(mm_gfill_par_t));
+			p.opt = opt, p.mat = mat, p.rs0 = rs0, p.extra_flag = extra_flag;
+			p.qseq = qseq0[rev], p.ref = ref, p.coor = coor, p.task = task;
+			p.ez = g->ez = (ksw_extz_t*)kcalloc(km, g->n_par, sizeof(ksw_extz_t));
+			p.km = (void**)kcalloc(km, n_threads, sizeof(void*));
+			for (i = 0; i < n_threads; ++i)
+				if (!(mm_dbg_flag & MM_DBG_NO_KALLOC)) p.km[i] = km_init();
+			kt_for(n_threads, gfill_par_worker, &p, g->n_par);
+			for (i = 0; i < n_threads; ++i) km_destroy(p.km[i]);
+			kfree(km, p.km);
+		} else {
+			for (i = 0; i < g->n_gap; ++i) g->pidx[i] = -1;
+			g->n_par = 0;
+		}
+	}
+	kfree(km, srt);
+	kfree(km, coor);
+}
+
+static void mm_gfill_destroy(void *km, mm_gfill_t *g)
+{
+	int i;
+	for (i = 0; i < g->n; ++i) kfree(km, g->b[i].cigar);
+	for (i = 0; i < g->n_par; ++i) free(g->ez[i].cigar);
+	kfree(km, g->b); kfree(km, g->idx);
+	kfree(km, g->pidx); kfree(km, g->ez);
+}
+
 static int *collect_long_gaps(void *km, int as1, int cnt1, mm128_t *a, int min_gap, int *n_)
 {
 	int i, n, *K;
@@ -539,15 +795,19 @@ static void mm_fix_bad_ends_splice(void *km, mm_mapopt_t *opt, const mm_idx_t *m
 	}
 }
 
-static void mm_align1(void *km, mm_mapopt_t *opt, const mm_idx_t *mi, int qlen, uint8_t *qseq0[2], mm_reg1_t *r, mm_reg1_t *r2, int n_a, mm128_t *a, ksw_extz_t *ez, int splice_flag)
+static void mm_align1(void *km, mm_mapopt_t *opt, const mm_idx_t *mi, int qlen, uint8_t *qseq0[2], const mm_qprof_t *qp, mm_reg1_t *r, mm_reg1_t *r2, int n_a, mm128_t *a, ksw_extz_t *ez, mm_refcache_t *rc, int splice_flag, int n_threads)
 {
 	int is_sr = !!(opt->flag & MM_F_SR), is_splice = !!(opt->flag & MM_F_SPLICE);
+	int fast_gap = !is_splice && !(mm_dbg_flag & MM_DBG_PRINT_ALN_SEQ);
+	int wfa_flag = opt->max_wfa_div > 0.0f && r->div >= 0.0f && r->div < opt->max_wfa_div? MM_ALN_WFA : 0; // WFA is fast on similar sequences
 	int32_t rid = a[r->as].x<<1>>33, rev = a[r->as].x>>63, as1, cnt1;
-	uint8_t *tseq, *qseq;
+	const uint8_t *ref, *tseq; // ref[]: the reference from _rs0_, decoded once
+	const uint8_t *qseq;
 	int32_t i, l, bw, dropped = 0, extra_flag = 0, rs0, re0, qs0, qe0;
 	int32_t rs, re, qs, qe;
-	int32_t rs1, qs1, re1, qe1;
+	int32_t rs1, qs1, re1, qe1, n_gf, sc;
 	int8_t mat[25];
+	mm_gfill_t gf;
 
 	if (is_sr) assert(!(mi->flag & MM_I_HPC)); // HPC won't work with SR because with HPC we can't easily tell if there is a gap
 
@@ -661,26 +921,31 @@ static void mm_align1(void *km, mm_mapopt_t *opt, const mm_idx_t *mi, int qlen,
 	}
 
 	assert(re0 > rs0);
-	tseq = (uint8_t*)kmalloc(km, re0 - rs0);
+	if (rs0 > rs) rs0 = rs; // so that ref[] covers all anchors
+	if (re0 < re) re0 = re;
+	ref = mm_refcache_get(km, rc, mi, rid, rs0, re0);
 
 	if (qs > 0 && rs > 0) { // left extension
-		qseq = &qseq0[rev][qs0];
-		mm_idx_getseq(mi, rid, rs0, rs, tseq);
-		mm_seq_rev(qs - qs0, qseq);
-		mm_seq_rev(rs - rs0, tseq);
-		mm_align_pair(km, opt, qs - qs0, qseq, rs - rs0, tseq, mat, bw, opt->end_bonus, r->split_inv? opt->zdrop_inv : opt->zdrop, extra_flag|KSW_EZ_EXTZ_ONLY|KSW_EZ_RIGHT|KSW_EZ_REV_CIGAR, ez);
+		uint8_t *trev;
+		qseq = &qp->rev[rev][qlen - qs]; // extend leftwards on the reversed sequences
+		trev = (uint8_t*)kmalloc(km, rs - rs0);
+		for (i = 0; i < rs - rs0; ++i) trev[i] = ref[rs - rs0 - 1 - i];
+		mm_align_pair(km, opt, qs - qs0, qseq, rs - rs0, trev, mat, bw, opt->end_bonus, r->split_inv? opt->zdrop_inv : opt->zdrop, extra_flag|KSW_EZ_EXTZ_ONLY|KSW_EZ_RIGHT|KSW_EZ_REV_CIGAR, ez);
 		if (ez->n_cigar > 0) {
 			mm_append_cigar(r, ez->n_cigar, ez->cigar);
 			r->p->dp_score += ez->max;
 		}
 		rs1 = rs - (ez->reach_end? ez->mqe_t + 1 : ez->max_t + 1);
 		qs1 = qs - (ez->reach_end? qs - qs0 : ez->max_q + 1);
-		mm_seq_rev(qs - qs0, qseq);
+		kfree(km, trev);
 	} else rs1 = rs, qs1 = qs;
 	re1 = rs, qe1 = qs;
 	assert(qs1 >= 0 && rs1 >= 0);
 
-	for (i = is_sr? cnt1 - 1 : 1; i < cnt1; ++i) { // gap filling
+	if (!is_sr && (!is_splice || n_threads > 1) && !(mm_dbg_flag & MM_DBG_PRINT_ALN_SEQ))
+		mm_gfill_first_pass(km, opt, mi, qseq0, ref, rs0, a, as1, cnt1, rs, qs, bw, mat, extra_flag|wfa_flag, n_threads, &gf);
+	else memset(&gf, 0, sizeof(mm_gfill_t));
+	for (i = is_sr? cnt1 - 1 : 1, n_gf = 0; i < cnt1; ++i) { // gap filling
 		if ((a[as1+i].y & (MM_SEED_IGNORE|MM_SEED_TANDEM)) && i != cnt1 - 1) continue;
 		if (is_sr && !(mi->flag & MM_I_HPC)) {
 			re = (int32_t)a[as1 + i].x + 1;
@@ -692,8 +957,7 @@ static void mm_align1(void *km, mm_mapopt_t *opt, const mm_idx_t *mi, int qlen,
 			if (a[as1+i].y & MM_SEED_LONG_JOIN)
 				bw1 = qe - qs > re - rs? qe - qs : re - rs;
 			// perform alignment
-			qseq = &qseq0[rev][qs];
-			mm_idx_getseq(mi, rid, rs, re, tseq);
+			qseq = &qseq0[rev][qs], tseq = &ref[rs - rs0];
 			if (is_sr) { // perform ungapped alignment
 				assert(qe - qs == re - rs);
 				ksw_reset_extz(ez);
@@ -702,9 +966,33 @@ static void mm_align1(void *km, mm_mapopt_t *opt, const mm_idx_t *mi, int qlen,
 					else ez->score += qseq[j] == tseq[j]? opt->a : -opt->b;
 				}
 				ez->cigar = ksw_push_cigar(km, &ez->n_cigar, &ez->m_cigar, ez->cigar, 0, qe - qs);
+			} else if (gf.n > 0 && gf.idx[n_gf] >= 0) { // first pass already done in a SIMD batch
+				const ksw_ggb_t *p = &gf.b[gf.idx[n_gf]];
+				ksw_reset_extz(ez);
+				ez->score = p->score;
+				for (j = 0; j < p->n_cigar; ++j)
+					ez->cigar = ksw_push_cigar(km, &ez->n_cigar, &ez->m_cigar, ez->cigar, p->cigar[j]&0xf, p->cigar[j]>>4);
+			} else if (gf.n_par > 0 && gf.pidx[n_gf] >= 0) { // first pass already done by another thread
+				const ksw_extz_t *p = &gf.ez[gf.pidx[n_gf]];
+				int m_cigar = ez->m_cigar;
+				uint32_t *cigar = ez->cigar;
+				*ez = *p, ez->m_cigar = m_cigar, ez->cigar = cigar, ez->n_cigar = 0; // keep the CIGAR buffer of _ez_
+				for (j = 0; j < p->n_cigar; ++j)
+					ez->cigar = ksw_push_cigar(km, &ez->n_cigar, &ez->m_cigar, ez->cigar, p->cigar[j]&0xf, p->cigar[j]>>4);
+			} else if (fast_gap && (sc = mm_ungapped_score(km, opt, qe - qs, qseq, re - rs, tseq)) != KSW_NEG_INF) { // DP would find the same
+				if (mm_dbg_flag & MM_DBG_CHECK_GAP) {
+					mm_align_pair(km, opt, qe - qs, qseq, re - rs, tseq, mat, bw1, -1, opt->zdrop, extra_flag|KSW_EZ_APPROX_MAX, ez);
+					if (ez->score != sc || ez->n_cigar != 1 || ez->cigar[0] != (uint32_t)(qe - qs) << 4)
+						fprintf(stderr, "[W::%s] ungapped gap filling disagrees with DP at %s:%d-%d\n", __func__, mi->seq[rid].name, rs, re);
+				} else {
+					ksw_reset_extz(ez);
+					ez->score = sc;
+					ez->cigar = ksw_push_cigar(km, &ez->n_cigar, &ez->m_cigar, ez->cigar, 0, qe - qs);
+				}
 			} else { // perform normal gapped alignment
-				mm_align_pair(km, opt, qe - qs, qseq, re - rs, tseq, mat, bw1, -1, opt->zdrop, extra_flag|KSW_EZ_APPROX_MAX, ez); // first pass: with approximate Z-drop
+				mm_align_pair(km, opt, qe - qs, qseq, re - rs, tseq, mat, bw1, -1, opt->zdrop, extra_flag|wfa_flag|KSW_EZ_APPROX_MAX, ez); // first pass: with approximate Z-drop
 			}
+			++n_gf;
 			// test Z-drop and inversion Z-drop
 			if ((zdrop_code = mm_test_zdrop(km, opt, qseq, tseq, ez->n_cigar, ez->cigar, mat)) != 0)
 				mm_align_pair(km, opt, qe - qs, qseq, re - rs, tseq, mat, bw1, -1, zdrop_code == 2? opt->zdrop_inv : opt->zdrop, extra_flag, ez); // second pass: lift approximate
@@ -729,10 +1017,10 @@ static void mm_align1(void *km, mm_mapopt_t *opt, const mm_idx_t *mi, int qlen,
 			rs = re, qs = qe;
 		}
 	}
+	mm_gfill_destroy(km, &gf);
 
 	if (!dropped && qe < qe0 && re < re0) { // right extension
-		qseq = &qseq0[rev][qe];
-		mm_idx_getseq(mi, rid, re, re0, tseq);
+		qseq = &qseq0[rev][qe], tseq = &ref[re - rs0];
 		mm_align_pair(km, opt, qe0 - qe, qseq, re0 - re, tseq, mat, bw, opt->end_bonus, opt->zdrop, extra_flag|KSW_EZ_EXTZ_ONLY, ez);
 		if (ez->n_cigar > 0) {
 			mm_append_cigar(r, ez->n_cigar, ez->cigar);
@@ -749,14 +1037,12 @@ static void mm_align1(void *km, mm_mapopt_t *opt, const mm_idx_t *mi, int qlen,
 
 	assert(re1 - rs1 <= re0 - rs0);
 	if (r->p) {
-		mm_idx_getseq(mi, rid, rs1, re1, tseq);
+		tseq = &ref[rs1 - rs0];
 		mm_update_extra(r, &qseq0[r->rev][qs1], tseq, mat, opt->q, opt->e);
 		if (opt->flag & MM_F_EQX) mm_update_cigar_eqx(r, &qseq0[r->rev][qs1], tseq);
 		if (rev && r->p->trans_strand)
 			r->p->trans_strand ^= 3; // flip to the read strand
 	}
-
-	kfree(km, tseq);
 }
 
 static int mm_align1_inv(void *km, mm_mapopt_t *opt, const mm_idx_t *mi, int qlen, uint8_t *qseq0[2], const mm_reg1_t *r1, const mm_reg1_t *r2, mm_reg1_t *r_inv, ksw_extz_t *ez)
@@ -827,32 +1113,17 @@ static inline mm_reg1_t *mm_insert_reg(const mm_reg1_t *r, int i, int *n_regs, m
 	return regs;
 }
 
-mm_reg1_t *mm_align_skeleton(void *km, mm_mapopt_t *opt, const mm_idx_t *mi, int qlen, const char *qstr, int *n_regs_, mm_reg1_t *regs, mm128_t *a)
+static mm_reg1_t *mm_align_regs(void *km, mm_mapopt_t *opt, const mm_idx_t *mi, int qlen, uint8_t *qseq0[2], const mm_qprof_t *qp, int *n_regs_, mm_reg1_t *regs, int n_a, mm128_t *a, ksw_extz_t *ez, mm_refcache_t *rc, int n_threads)
 {
-	extern unsigned char seq_nt4_table[256];
-	int32_t i, n_regs = *n_regs_, n_a;
-	uint8_t *qseq0[2];
-	ksw_extz_t ez;
-
-	// encode the query sequence
-	qseq0[0] = (uint8_t*)kmalloc(km, qlen * 2);
-	qseq0[1] = qseq0[0] + qlen;
-	for (i = 0; i < qlen; ++i) {
-		qseq0[0][i] = seq_nt4_table[(uint8_t)qstr[i]];
-		qseq0[1][qlen - 1 - i] = qseq0[0][i] < 4? 3 - qseq0[0][i] : 4;
-	}
-
-	// align through seed hits
-	n_a = mm_squeeze_a(km, n_regs, regs, a);
-	memset(&ez, 0, sizeof(ksw_extz_t));
+	int32_t i, n_regs = *n_regs_;
 	for (i = 0; i < n_regs; ++i) {
 		mm_reg1_t r2;
 		if ((opt->flag&MM_F_SPLICE) && (opt->flag&MM_F_SPLICE_FOR) && (opt->flag&MM_F_SPLICE_REV)) { // then do two rounds of alignments for both strands
 			mm_reg1_t s[2], s2[2];
 			int which, trans_strand;
 			s[0] = s[1] = regs[i];
-			mm_align1(km, opt, mi, qlen, qseq0, &s[0], &s2[0], n_a, a, &ez, MM_F_SPLICE_FOR);
-			mm_align1(km, opt, mi, qlen, qseq0, &s[1], &s2[1], n_a, a, &ez, MM_F_SPLICE_REV);
+			mm_align1(km, opt, mi, qlen, qseq0, qp, &s[0], &s2[0], n_a, a, ez, rc, MM_F_SPLICE_FOR, n_threads);
+			mm_align1(km, opt, mi, qlen, qseq0, qp, &s[1], &s2[1], n_a, a, ez, rc, MM_F_SPLICE_REV, n_threads);
 			if (s[0].p->dp_score > s[1].p->dp_score) which = 0, trans_strand = 1;
 			else if (s[0].p->dp_score < s[1].p->dp_score) which = 1, trans_strand = 2;
 			else trans_strand = 3, which = (qlen + s[0].p->dp_score) & 1; // randomly choose a strand, effectively
@@ -865,21 +1136,120 @@ mm_reg1_t *mm_align_skeleton(void *km, mm_mapopt_t *opt, const mm_idx_t *mi, int
 			}
 			regs[i].p->trans_strand = trans_strand;
 		} else { // one round of alignment
-			mm_align1(km, opt, mi, qlen, qseq0, &regs[i], &r2, n_a, a, &ez, opt->flag);
+			mm_align1(km, opt, mi, qlen, qseq0, qp, &regs[i], &r2, n_a, a, ez, rc, opt->flag, n_threads);
 			if (opt->flag&MM_F_SPLICE)
 				regs[i].p->trans_strand = opt->flag&MM_F_SPLICE_FOR? 1 : 2;
 		}
 		if (r2.cnt > 0) regs = mm_insert_reg(&r2, i, &n_regs, regs);
 		if (i > 0 && regs[i].split_inv) {
-			if (mm_align1_inv(km, opt, mi, qlen, qseq0, &regs[i-1], &regs[i], &r2, &ez)) {
+			if (mm_align1_inv(km, opt, mi, qlen, qseq0, &regs[i-1], &regs[i], &r2, ez)) {
 				regs = mm_insert_reg(&r2, i, &n_regs, regs);
 				++i; // skip the inserted INV alignment
 			}
 		}
 	}
 	*n_regs_ = n_regs;
+	return regs;
+}
+
+typedef struct {
+	mm_mapopt_t *opt;
+	const mm_idx_t *mi;
+	int qlen, n_a;
+	mm128_t *a;
+	const mm_reg1_t *regs;
+	int *n_out;
+	mm_reg1_t **out; // out[i]: alignments derived from regs[i], including regions split off by Z-drop and inversions
+	void **km;       // one per thread
+	uint8_t **qseq;  // one copy of the query per thread, as mm_align1_inv() reverses parts of it in place
+	const mm_qprof_t *qp;
+	ksw_extz_t *ez;
+	mm_refcache_t *rc;
+} mm_align_par_t;
+
+static void align_par_worker(void *data, long i, int tid) // kt_for() callback
+{
+	mm_align_par_t *p = (mm_align_par_t*)data;
+	uint8_t *qseq0[2];
+	qseq0[0] = p->qseq[tid], qseq0[1] = qseq0[0] + p->qlen;
+	p->n_out[i] = 1;
+	p->out[i] = (mm_reg1_t*)malloc(sizeof(mm_reg1_t));
+	p->out[i][0] = p->regs[i];
+	p->out[i] = mm_align_regs(p->km[tid], p->opt, p->mi, p->qlen, qseq0, p->qp, &p->n_out[i], p->out[i], p->n_a, p->a, &p->ez[tid], &p->rc[tid], 1);
+}
+
+// Align regions in parallel. An original region never has split_inv set, so the regions split off a region only depend on that
+// region and the output is the same as mm_align_regs().
+static mm_reg1_t *mm_align_regs_par(void *km, mm_mapopt_t *opt, const mm_idx_t *mi, int qlen, uint8_t *qseq0[2], const mm_qprof_t *qp, int *n_regs_, mm_reg1_t *regs, int n_a, mm128_t *a, int n_threads)
+{
+	int32_t i, k, n_regs = *n_regs_;
+	mm_align_par_t p;
+
+	if (n_threads > n_regs) n_threads = n_regs;
+	memset(&p, 0, sizeof(mm_align_par_t));
+	p.opt = opt, p.mi = mi, p.qlen = qlen, p.n_a = n_a, p.a = a, p.regs = regs, p.qp = qp;
+	p.n_out = (int*)kcalloc(km, n_regs, sizeof(int));
+	p.out = (mm_reg1_t**)kcalloc(km, n_regs, sizeof(mm_reg1_t*));
+	p.km = (void**)kcalloc(km, n_threads, sizeof(void*));
+	p.qseq = (uint8_t**)kcalloc(km, n_threads, sizeof(uint8_t*));
+	p.ez = (ksw_extz_t*)kcalloc(km, n_threads, sizeof(ksw_extz_t));
+	p.rc = (mm_refcache_t*)kcalloc(km, n_threads, sizeof(mm_refcache_t));
+	for (i = 0; i < n_threads; ++i) {
+		if (!(mm_dbg_flag & MM_DBG_NO_KALLOC)) p.km[i] = km_init();
+		p.qseq[i] = (uint8_t*)kmalloc(p.km[i], qlen * 2);
+		memcpy(p.qseq[i], qseq0[0], qlen * 2);
+	}
+	kt_for(n_threads, align_par_worker, &p, n_regs);
+	for (i = 0; i < n_threads; ++i) {
+		kfree(p.km[i], p.qseq[i]);
+		kfree(p.km[i], p.ez[i].cigar);
+		mm_refcache_destroy(p.km[i], &p.rc[i]);
+		km_destroy(p.km[i]);
+	}
+	for (i = 0, *n_regs_ = 0; i < n_regs; ++i)
+		*n_regs_ += p.n_out[i];
+	regs = (mm_reg1_t*)realloc(regs, *n_regs_ * sizeof(mm_reg1_t));
+	for (i = 0, k = 0; i < n_regs; ++i) { // merge in the original order
+		memcpy(&regs[k], p.out[i], p.n_out[i] * sizeof(mm_reg1_t));
+		k += p.n_out[i];
+		free(p.out[i]);
+	}
+	kfree(km, p.n_out); kfree(km, p.out); kfree(km, p.km); kfree(km, p.qseq); kfree(km, p.ez); kfree(km, p.rc);
+	return regs;
+}
+
+mm_reg1_t *mm_align_skeleton(void *km, mm_mapopt_t *opt, const mm_idx_t *mi, int qlen, const char *qstr, int *n_regs_, mm_reg1_t *regs, mm128_t *a)
+{
+	extern unsigned char seq_nt4_table[256];
+	int32_t i, n_regs = *n_regs_, n_a, max_cnt, n_threads;
+	uint8_t *qseq0[2];
+	ksw_extz_t ez;
+	mm_refcache_t rc;
+	mm_qprof_t qp;
+
+	// encode the query sequence and its reversed strands
+	qseq0[0] = (uint8_t*)kmalloc(km, qlen * 4);
+	qseq0[1] = qseq0[0] + qlen;
+	qp.rev[0] = qseq0[1] + qlen, qp.rev[1] = qp.rev[0] + qlen;
+	for (i = 0; i < qlen; ++i) {
+		qseq0[0][i] = qp.rev[0][qlen - 1 - i] = seq_nt4_table[(uint8_t)qstr[i]];
+		qseq0[1][qlen - 1 - i] = qp.rev[1][i] = qseq0[0][i] < 4? 3 - qseq0[0][i] : 4;
+	}
+
+	// align through seed hits
+	n_a = mm_squeeze_a(km, n_regs, regs, a);
+	memset(&ez, 0, sizeof(ksw_extz_t));
+	memset(&rc, 0, sizeof(mm_refcache_t));
+	n_threads = opt->aln_n_threads > 1 && qlen >= MM_ALN_PAR_MIN_LEN? opt->aln_n_threads : 1;
+	for (i = 0, max_cnt = 0; i < n_regs; ++i)
+		max_cnt = max_cnt > regs[i].cnt? max_cnt : regs[i].cnt;
+	if (n_threads > 1 && n_regs > 1 && max_cnt * 2 < n_a) // no region dominates; otherwise parallelize over gaps of each region
+		regs = mm_align_regs_par(km, opt, mi, qlen, qseq0, &qp, &n_regs, regs, n_a, a, n_threads);
+	else regs = mm_align_regs(km, opt, mi, qlen, qseq0, &qp, &n_regs, regs, n_a, a, &ez, &rc, n_threads);
+	*n_regs_ = n_regs;
 	kfree(km, qseq0[0]);
 	kfree(km, ez.cigar);
+	mm_refcache_destroy(km, &rc);
 	mm_filter_regs(opt, qlen, n_regs_, regs);
 	mm_hit_sort(km, n_regs_, regs);
 	return regs;
@@ -6,8 +6,14 @@
 #include "minimap.h"
 #include "mmpriv.h"
 #include "kalloc.h"
+#include "kthread.h"
+#include "kvec.h"
 #include <pthread.h>
 
+#define MM_CHAIN_PAR_MIN_N     100000  // only chain in parallel with at least this many anchors
+#define MM_CHAIN_COMPACT_MIN_N 1000000 // use the DP with compact per-anchor state with at least this many anchors
+#define MM_CHAIN_RING          256     // size of the ring buffers in chain_dp_compact(); must be larger than max_iter
+
 static const char LogTable256[256] = {
 #define LT(n) n, n, n, n, n, n, n, n, n, n, n, n, n, n, n, n
 	-1, 0, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 3, 3,
@@ -22,64 +28,251 @@ static inline int ilog2_32(uint32_t v)
 	return (t = v>>8) ? 8 + LogTable256[t] : LogTable256[v];
 }
 
-mm128_t *mm_chain_dp(int max_dist_x, int max_dist_y, int bw, int max_skip, int min_cnt, int min_sc, int is_cdna, int n_segs, int64_t n, mm128_t *a, int *n_u_, uint64_t **_u, void *km, mm_mapopt_t *opt)
-{ // TODO: make sure this works when n has more than 32 bits
-	int32_t k, *f, *p, *t, *v, n_u, n_v;
-	int64_t i, j, st = 0;
-	uint64_t *u, *u2, sum_qspan = 0;
+typedef struct {
+	int max_dist_x, max_dist_y, bw, max_skip, max_iter, is_cdna, n_segs;
 	float avg_qspan;
-	mm128_t *b, *w;
+	const mm_anchors_t *a;
+	int32_t *f, *p, *t, *v;
+	const int64_t *bd; // the k-th block of anchors is [bd[k],bd[k+1])
+} chain_aux_t;
 
-	if (_u) *_u = 0, *n_u_ = 0;
-	f = (int32_t*)kmalloc(km, n * 4);
-	p = (int32_t*)kmalloc(km, n * 4);
-	t = (int32_t*)kmalloc(km, n * 4);
-	v = (int32_t*)kmalloc(km, n * 4);
-	memset(t, 0, n * 4);
+#define anchor_x(a, i) ((uint64_t)(a)->tag[i]<<32 | (uint32_t)(a)->x[i]) // mm128_t::x of an anchor
 
-	for (i = 0; i < n; ++i) sum_qspan += a[i].y>>32&0xff;
-	avg_qspan = (float)sum_qspan / n;
+// score of appending a[i] to a chain ending at a[j], not counting the chain; INT32_MIN if a[j] can't precede a[i].
+// a[j] must be in the look-back window of a[i], where all anchors have the same tag.
+static inline int32_t chain_sc(const chain_aux_t *c, int64_t i, int64_t j)
+{
+	const mm_anchors_t *a = c->a;
+	int64_t dr = (int64_t)a->x[i] - a->x[j];
+	int32_t dq = a->y[i] - a->y[j], dd, sc, log_dd, min_d;
+	int32_t q_span = a->w[i]; // NB: only 8 bits of span is used!!!
+	int32_t sidi = a->seg[i], sidj = a->seg[j];
+	// optimization assertions, no splice support
+	assert(c->is_cdna == 0);
+	assert(sidi == sidj);
+	if ((/*sidi == sidj*/1 && dr == 0) || dq <= 0) return INT32_MIN; // don't skip if an anchor is used by multiple segments; see below
+	if ((/*sidi == sidj*/1 && dq > c->max_dist_y) || dq > c->max_dist_x) return INT32_MIN;
+	dd = dr > dq? dr - dq : dq - dr;
+	if (/*sidi == sidj*/1 && dd > c->bw) return INT32_MIN;
+	if (c->n_segs > 1 && /*!is_cdna*/1 && /*sidi == sidj*/1 && dr > c->max_dist_y) return INT32_MIN;
+	min_d = dq < dr? dq : dr;
+	sc = min_d > q_span? q_span : dq < dr? dq : dr;
+	log_dd = dd? ilog2_32(dd) : 0;
+	if (/*is_cdna*/0 || /*sidi != sidj*/0) {
+		int c_log, c_lin;
+		c_lin = (int)(dd * .01 * c->avg_qspan);
+		c_log = log_dd;
+		if (sidi != sidj && dr == 0) ++sc; // possibly due to overlapping paired ends; give a minor bonus
+		else if (dr > dq || sidi != sidj) sc -= c_lin < c_log? c_lin : c_log;
+		else sc -= c_lin + (c_log>>1);
+	} else sc -= (int)(dd * .01 * c->avg_qspan) + (log_dd>>1);
+	return sc;
+}
 
-	// fill the score and backtrack arrays
-	for (i = 0; i < n; ++i) {
-		uint64_t ri = a[i].x;
+// fill the score and backtrack arrays for a[st..en); no anchor in the range may chain to an anchor before st
+static void chain_fill(const chain_aux_t *c, int64_t st, int64_t en)
+{
+	int max_dist_x = c->max_dist_x, max_skip = c->max_skip, max_iter = c->max_iter;
+	const mm_anchors_t *a = c->a;
+	int32_t *f = c->f, *p = c->p, *t = c->t, *v = c->v;
+	int64_t i, j;
+
+	for (i = st; i < en; ++i) {
+		uint64_t ri = anchor_x(a, i);
 		int64_t max_j = -1;
-		int32_t qi = (int32_t)a[i].y, q_span = a[i].y>>32&0xff; // NB: only 8 bits of span is used!!!
-		int32_t max_f = q_span, min_d;
-		int32_t sidi = (a[i].y & MM_SEED_SEG_MASK) >> MM_SEED_SEG_SHIFT;
-		while (st < i && ri > a[st].x + max_dist_x) ++st;
-		int h = 65;
-		for (j = i - 1; j >= st && j > i - h; --j) {
-			int64_t dr = ri - a[j].x;
-			int32_t dq = qi - (int32_t)a[j].y, dd, sc, log_dd;
-			int32_t sidj = (a[j].y & MM_SEED_SEG_MASK) >> MM_SEED_SEG_SHIFT;
-			// optimization assertions, no splice support
-			assert(is_cdna == 0);
-			assert(sidi == sidj);
-			if ((/*sidi == sidj*/1 && dr == 0) || dq <= 0) continue; // don't skip if an anchor is used by multiple segments; see below
-			if ((/*sidi == sidj*/1 && dq > max_dist_y) || dq > max_dist_x) continue;
-			dd = dr > dq? dr - dq : dq - dr;
-			if (/*sidi == sidj*/1 && dd > bw) continue;
-			if (n_segs > 1 && /*!is_cdna*/1 && /*sidi == sidj*/1 && dr > max_dist_y) continue;
-			min_d = dq < dr? dq : dr;
-			sc = min_d > q_span? q_span : dq < dr? dq : dr;
-			log_dd = dd? ilog2_32(dd) : 0;
-			if (/*is_cdna*/0 || /*sidi != sidj*/0) {
-				int c_log, c_lin;
-				c_lin = (int)(dd * .01 * avg_qspan);
-				c_log = log_dd;
-				if (sidi != sidj && dr == 0) ++sc; // possibly due to overlapping paired ends; give a minor bonus
-				else if (dr > dq || sidi != sidj) sc -= c_lin < c_log? c_lin : c_log;
-				else sc -= c_lin + (c_log>>1);
-			} else sc -= (int)(dd * .01 * avg_qspan) + (log_dd>>1);
+		int32_t max_f = a->w[i], n_skip = 0, sc;
+		while (st < i && ri > anchor_x(a, st) + max_dist_x) ++st;
+		if (i - st > max_iter) st = i - max_iter;
+		for (j = i - 1; j >= st; --j) {
+			if ((sc = chain_sc(c, i, j)) == INT32_MIN) continue;
 			sc += f[j];
 			if (sc > max_f) {
 				max_f = sc, max_j = j;
+				if (n_skip > 0) --n_skip;
+			} else if (max_skip > 0 && t[j] == i) { // j is the predecessor of an anchor seen earlier in this loop
+				if (++n_skip > max_skip)
+					break;
 			}
+			if (p[j] >= 0) t[p[j]] = i;
 		}
 		f[i] = max_f, p[i] = max_j;
 		v[i] = max_j >= 0 && v[max_j] > max_f? v[max_j] : max_f; // v[] keeps the peak score up to i; f[] is the score ending at i, not always the peak
 	}
+}
+
+static void chain_fill_worker(void *data, long k, int tid)
+{
+	const chain_aux_t *c = (const chain_aux_t*)data;
+	chain_fill(c, c->bd[k], c->bd[k+1]);
+}
+
+// write the anchors on the n_u chains in u[] to a new array; v[] lists anchor indices on each chain from the end
+static mm128_t *chain_write(void *km, int32_t n_u, uint64_t *u, int32_t n_v, int32_t *v, const mm_anchors_t *sa)
+{
+	int32_t i, j, k;
+	mm128_t *a, *b, *w;
+	uint64_t *u2;
+
+	// write the result to a[]; only anchors on chains are converted to mm128_t
+	a = (mm128_t*)kmalloc(km, n_v * sizeof(mm128_t));
+	for (i = 0, k = 0; i < n_u; ++i) {
+		int32_t k0 = k, ni = (int32_t)u[i];
+		for (j = 0; j < ni; ++j, ++k) {
+			int32_t l = v[k0 + (ni - j - 1)];
+			a[k].x = anchor_x(sa, l);
+			a[k].y = (uint64_t)sa->seg[l] << MM_SEED_SEG_SHIFT | (uint64_t)sa->flag[l] << 40 | (uint64_t)sa->w[l] << 32 | (uint32_t)sa->y[l];
+		}
+	}
+	kfree(km, v);
+	kfree(km, sa->tag);
+
+	// sort u[] and a[] by a[].x, such that adjacent chains may be joined (required by mm_join_long)
+	w = (mm128_t*)kmalloc(km, n_u * sizeof(mm128_t));
+	for (i = k = 0; i < n_u; ++i) {
+		w[i].x = a[k].x, w[i].y = (uint64_t)k<<32|i;
+		k += (int32_t)u[i];
+	}
+	radix_sort_128x(w, w + n_u);
+	u2 = (uint64_t*)kmalloc(km, n_u * 8);
+	b = (mm128_t*)kmalloc(km, n_v * sizeof(mm128_t));
+	for (i = k = 0; i < n_u; ++i) {
+		int32_t j = (int32_t)w[i].y, n = (int32_t)u[j];
+		u2[i] = u[j];
+		memcpy(&b[k], &a[w[i].y>>32], n * sizeof(mm128_t));
+		k += n;
+	}
+	memcpy(u, u2, n_u * 8);
+	kfree(km, a); kfree(km, w); kfree(km, u2);
+	return b;
+}
+
+/* DP with compact per-anchor state for queries with many anchors. Backtracking
+ * needs f[] and the predecessor of every anchor, kept as a one-byte offset. The peak
+ * score, the position of the peak and the marks used by max_skip are only read
+ * within the look-back window, so they live in ring buffers, and a chain end is
+ * collected when its anchor leaves the window. This takes 5 bytes per anchor
+ * plus a bit for backtracking, instead of the 16 bytes of the arrays in
+ * mm_chain_dp(). The result is identical. Memory is still linear in the number of
+ * anchors, which are all materialized; only the state per anchor is smaller. */
+static mm128_t *chain_dp_compact(const chain_aux_t *c, int min_cnt, int min_sc, int *n_u_, uint64_t **_u, void *km)
+{
+	const mm_anchors_t *a = c->a;
+	int64_t n = a->n;
+	const int64_t M = MM_CHAIN_RING - 1;
+	int32_t *f, vr[MM_CHAIN_RING], k;
+	int64_t i, j, st = 0, pr[MM_CHAIN_RING], tr[MM_CHAIN_RING];
+	uint8_t *d, *vis, er[MM_CHAIN_RING];
+	kvec_t(uint64_t) u = {0,0,0};
+	kvec_t(int32_t) v = {0,0,0};
+
+	f = (int32_t*)kmalloc(km, n * 4);
+	d = (uint8_t*)kmalloc(km, n); // a[i-d[i]] precedes a[i]; 0 for none
+	for (i = 0; i < n + c->max_iter; ++i) {
+		if (i < n) {
+			uint64_t ri = anchor_x(a, i);
+			int64_t max_j = -1;
+			int32_t max_f = a->w[i], n_skip = 0, sc;
+			while (st < i && ri > anchor_x(a, st) + c->max_dist_x) ++st;
+			if (i - st > c->max_iter) st = i - c->max_iter;
+			for (j = i - 1; j >= st; --j) {
+				int64_t pj;
+				if ((sc = chain_sc(c, i, j)) == INT32_MIN) continue;
+				sc += f[j];
+				if (sc > max_f) {
+					max_f = sc, max_j = j;
+					if (n_skip > 0) --n_skip;
+				} else if (c->max_skip > 0 && tr[j&M] == i) {
+					if (++n_skip > c->max_skip)
+						break;
+				}
+				pj = d[j]? j - d[j] : -1;
+				if (pj >= st) tr[pj&M] = i; // the slot of an anchor before st may have been reused
+			}
+			f[i] = max_f, d[i] = max_j >= 0? i - max_j : 0;
+			tr[i&M] = -1, er[i&M] = 0;
+			if (max_j >= 0 && vr[max_j&M] > max_f) vr[i&M] = vr[max_j&M], pr[i&M] = pr[max_j&M];
+			else vr[i&M] = max_f, pr[i&M] = i;
+			if (max_j >= 0) er[max_j&M] = 1;
+		}
+		j = i - c->max_iter; // no anchor after a[i] may chain to a[j]
+		if (j >= 0 && er[j&M] == 0 && vr[j&M] >= min_sc)
+			kv_push(uint64_t, km, u, (uint64_t)vr[j&M] << 32 | pr[j&M]);
+	}
+	if (u.n == 0) {
+		kfree(km, a->tag); kfree(km, f); kfree(km, d);
+		return 0;
+	}
+	radix_sort_64(u.a, u.a + u.n);
+	for (i = 0; i < u.n>>1; ++i) { // reverse, s.t. the highest scoring chain is the first
+		uint64_t t = u.a[i];
+		u.a[i] = u.a[u.n - i - 1], u.a[u.n - i - 1] = t;
+	}
+
+	// backtrack
+	vis = (uint8_t*)kcalloc(km, (n + 7) >> 3, 1);
+	for (i = k = 0; i < u.n; ++i) { // starting from the highest score
+		int32_t n_v0 = v.n, k0 = k;
+		j = (int32_t)u.a[i];
+		do {
+			kv_push(int32_t, km, v, j);
+			vis[j>>3] |= 1<<(j&7);
+			j = d[j]? j - d[j] : -1;
+		} while (j >= 0 && (vis[j>>3]>>(j&7)&1) == 0);
+		if (j < 0) {
+			if (v.n - n_v0 >= min_cnt) u.a[k++] = u.a[i]>>32<<32 | (v.n - n_v0);
+		} else if ((int32_t)(u.a[i]>>32) - f[j] >= min_sc) {
+			if (v.n - n_v0 >= min_cnt) u.a[k++] = ((u.a[i]>>32) - f[j]) << 32 | (v.n - n_v0);
+		}
+		if (k0 == k) v.n = n_v0; // no new chain added, reset
+	}
+	*n_u_ = k, *_u = u.a; // NB: note that u[] may not be sorted by score here
+
+	kfree(km, f); kfree(km, d); kfree(km, vis);
+	return chain_write(km, k, u.a, v.n, v.a, a);
+}
+
+mm128_t *mm_chain_dp(int max_dist_x, int max_dist_y, int bw, int max_skip, int max_iter, int min_cnt, int min_sc, int is_cdna, int n_segs, mm_anchors_t *a, int *n_u_, uint64_t **_u, void *km, mm_mapopt_t *opt)
+{ // TODO: make sure this works when n has more than 32 bits
+	int32_t k, *f, *p, *t, *v, n_u, n_v;
+	int64_t i, j, n = a->n;
+	uint64_t *u, sum_qspan = 0;
+	float avg_qspan;
+	chain_aux_t c;
+
+	if (_u) *_u = 0, *n_u_ = 0;
+	for (i = 0; i < n; ++i) sum_qspan += a->w[i];
+	avg_qspan = (float)sum_qspan / n;
+
+	c.max_dist_x = max_dist_x, c.max_dist_y = max_dist_y, c.bw = bw, c.max_skip = max_skip, c.max_iter = max_iter;
+	c.is_cdna = is_cdna, c.n_segs = n_segs, c.avg_qspan = avg_qspan;
+	c.a = a, c.bd = 0;
+	if (n >= MM_CHAIN_COMPACT_MIN_N && max_iter < MM_CHAIN_RING && opt->chain_n_threads <= 1 && !opt->chain_dump_in.fp && !opt->chain_dump_out.fp)
+		return chain_dp_compact(&c, min_cnt, min_sc, n_u_, _u, km);
+
+	f = (int32_t*)kmalloc(km, n * 4);
+	p = (int32_t*)kmalloc(km, n * 4);
+	t = (int32_t*)kmalloc(km, n * 4);
+	v = (int32_t*)kmalloc(km, n * 4);
+	memset(t, 0, n * 4);
+	c.f = f, c.p = p, c.t = t, c.v = v;
+
+	// fill the score and backtrack arrays
+	if (opt->chain_n_threads > 1 && n >= MM_CHAIN_PAR_MIN_N) {
+		// no predecessor is searched across a strand/reference change or an x gap
+		// longer than max_dist_x, so the DP splits into independent blocks there
+		int64_t *bd, min_len = n / (opt->chain_n_threads * 4) + 1;
+		int n_bd = 0;
+		bd = (int64_t*)kmalloc(km, (n / min_len + 2) * sizeof(int64_t));
+		bd[n_bd++] = 0;
+		for (i = 1; i < n; ++i)
+			if (i - bd[n_bd-1] >= min_len && (a->tag[i] != a->tag[i-1] || (int64_t)a->x[i] > (int64_t)a->x[i-1] + max_dist_x))
+				bd[n_bd++] = i;
+		bd[n_bd] = n;
+		c.bd = bd;
+		if (n_bd > 1) kt_for(opt->chain_n_threads, chain_fill_worker, &c, n_bd);
+		else chain_fill(&c, 0, n);
+		kfree(km, bd);
+	} else chain_fill(&c, 0, n);
 
 	if (opt->chain_dump_in.fp || opt->chain_dump_out.fp) {
 		pthread_mutex_lock(&(opt->chain_dump_in.mutex));
@@ -93,14 +286,10 @@ mm128_t *mm_chain_dp(int max_dist_x, int max_dist_y, int bw, int max_skip, int m
 				fclose(opt->chain_dump_out.fp);
 				exit(0);
 			}
-			fprintf(fp, "%lld\t%.6f\t%d\t%d\t%d\n",
-					(long long)n, avg_qspan, max_dist_x, max_dist_y, bw);
+			fprintf(fp, "%lld\t%.6f\t%d\t%d\t%d\t%d\t%d\n",
+					(long long)n, avg_qspan, max_dist_x, max_dist_y, bw, max_skip, max_iter);
 			for (i = 0; i < n; ++i) {
-				fprintf(fp, "%u\t%d\t%d\t%d\n",
-						(unsigned int)(uint32_t)(a[i].x >> 32),
-						(int)(int32_t)(a[i].x),
-						(int)(int32_t)(a[i].y >> 32 & 0xff),
-						(int)(int32_t)(a[i].y));
+				fprintf(fp, "%u\t%d\t%d\t%d\n", a->tag[i], a->x[i], a->w[i], a->y[i]);
 			}
 			fprintf(fp, "EOR\n");
 		}
@@ -126,7 +315,7 @@ mm128_t *mm_chain_dp(int max_dist_x, int max_dist_y, int bw, int max_skip, int m
 		if (t[i] == 0 && v[i] >= min_sc)
 			++n_u;
 	if (n_u == 0) {
-		kfree(km, a); kfree(km, f); kfree(km, p); kfree(km, t); kfree(km, v);
+		kfree(km, a->tag); kfree(km, f); kfree(km, p); kfree(km, t); kfree(km, v);
 		return 0;
 	}
 	u = (uint64_t*)kmalloc(km, n_u * 8);
@@ -165,32 +354,5 @@ mm128_t *mm_chain_dp(int max_dist_x, int max_dist_y, int bw, int max_skip, int m
 
 	// free temporary arrays
 	kfree(km, f); kfree(km, p); kfree(km, t);
-
-	// write the result to b[]
-	b = (mm128_t*)kmalloc(km, n_v * sizeof(mm128_t));
-	for (i = 0, k = 0; i < n_u; ++i) {
-		int32_t k0 = k, ni = (int32_t)u[i];
-		for (j = 0; j < ni; ++j)
-			b[k] = a[v[k0 + (ni - j - 1)]], ++k;
-	}
-	kfree(km, v);
-
-	// sort u[] and a[] by a[].x, such that adjacent chains may be joined (required by mm_join_long)
-	w = (mm128_t*)kmalloc(km, n_u * sizeof(mm128_t));
-	for (i = k = 0; i < n_u; ++i) {
-		w[i].x = b[k].x, w[i].y = (uint64_t)k<<32|i;
-		k += (int32_t)u[i];
-	}
-	radix_sort_128x(w, w + n_u);
-	u2 = (uint64_t*)kmalloc(km, n_u * 8);
-	for (i = k = 0; i < n_u; ++i) {
-		int32_t j = (int32_t)w[i].y, n = (int32_t)u[j];
-		u2[i] = u[j];
-		memcpy(&a[k], &b[w[i].y>>32], n * sizeof(mm128_t));
-		k += n;
-	}
-	memcpy(u, u2, n_u * 8);
-	memcpy(b, a, k * sizeof(mm128_t)); // write _a_ to _b_ and deallocate _a_ because _a_ is oversized, sometimes a lot
-	kfree(km, a); kfree(km, w); kfree(km, u2);
-	return b;
+	return chain_write(km, n_u, u, n_v, v, a);
 }
@@ -4,9 +4,13 @@
 #include <io.h> // for open(2)
 #else
 #include <unistd.h>
+#include <sys/mman.h>
 #endif
 #include <fcntl.h>
 #include <stdio.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #define __STDC_LIMIT_MACROS
 #include "kthread.h"
 #include "bseq.h"
@@ -15,22 +19,64 @@
 #include "kvec.h"
 #include "khash.h"
 
-#define idx_hash(a) ((a)>>1)
-#define idx_eq(a, b) ((a)>>1 == (b)>>1)
-KHASH_INIT(idx, uint64_t, uint64_t, 1, idx_hash, idx_eq)
-typedef khash_t(idx) idxhash_t;
-
 KHASH_MAP_INIT_STR(str, uint32_t)
 
 #define kroundup64(x) (--(x), (x)|=(x)>>1, (x)|=(x)>>2, (x)|=(x)>>4, (x)|=(x)>>8, (x)|=(x)>>16, (x)|=(x)>>32, ++(x))
 
+// Each bucket indexes its minimizers with an open-addressing table of (key, value) pairs and linear
+// probing. A key is minimizer>>b<<1, with the lowest bit set if the minimizer occurs once, in which
+// case the value is its position; otherwise the value is offset<<32|count into _p_. Positions of
+// singletons are thus stored inline and a lookup touches one cache line of _t_ in most cases.
 typedef struct mm_idx_bucket_s {
-	mm128_v a;   // (minimizer, position) array
-	int32_t n;   // size of the _p_ array
-	uint64_t *p; // position array for minimizers appearing >1 times
-	void *h;     // hash table indexing _p_ and minimizers appearing once
+	uint64_t *t;     // hash table indexing _p_ and minimizers appearing once
+	uint64_t *p;     // position array for minimizers appearing >1 times
+	uint8_t *pk;     // _p_ packed by mm_idx_pack(), which frees _p_; offsets in _t_ are then in bytes
+	uint32_t t_mask; // size of _t_ minus 1
+	int32_t n;       // size of the _p_ array
+	uint32_t n_pk;   // size of the _pk_ array
+	mm128_v a;       // (minimizer, position) array; only used during construction
 } mm_idx_bucket_t;
 
+#define MM_IDX_FLAT_EMPTY ((uint64_t)-1) // empty slot in _t_; never a valid key as keys have at most 57 bits
+#define MM_IDX_FLAT_HDR   48             // magic, 5 x uint32_t and 3 x uint64_t
+
+static inline uint32_t flat_slot(uint64_t key, uint32_t mask) { return (uint32_t)(key>>1) & mask; }
+
+static inline void flat_put(uint64_t *t, uint32_t mask, uint64_t key, uint64_t val)
+{
+	uint32_t j = flat_slot(key, mask);
+	while (t[(uint64_t)j<<1] != MM_IDX_FLAT_EMPTY)
+		j = (j + 1) & mask;
+	t[(uint64_t)j<<1] = key, t[(uint64_t)j<<1|1] = val;
+}
+
+static uint64_t flat_size(uint64_t n_key) // keep the load factor below 2/3
+{
+	uint64_t m;
+	if (n_key == 0) return 0;
+	m = n_key + (n_key>>1) + 1;
+	kroundup64(m);
+	return m;
+}
+
+static uint64_t bucket_n_key(const mm_idx_bucket_t *b)
+{
+	uint64_t j, n = 0;
+	if (b->t)
+		for (j = 0; j <= b->t_mask; ++j)
+			if (b->t[j<<1] != MM_IDX_FLAT_EMPTY) ++n;
+	return n;
+}
+
+static void bucket_alloc(mm_idx_bucket_t *b, uint64_t n_key)
+{
+	uint64_t m = flat_size(n_key);
+	if (m == 0) return;
+	b->t = (uint64_t*)malloc(m * 16);
+	memset(b->t, 0xff, m * 16); // fill with MM_IDX_FLAT_EMPTY
+	b->t_mask = m - 1;
+}
+
 mm_idx_t *mm_idx_init(int w, int k, int b, int flag)
 {
 	mm_idx_t *mi;
@@ -48,11 +94,11 @@ void mm_idx_destroy(mm_idx_t *mi)
 	uint32_t i;
 	if (mi == 0) return;
 	if (mi->h) kh_destroy(str, (khash_t(str)*)mi->h);
+	free(mi->name_rank);
 	if (mi->B) {
 		for (i = 0; i < 1U<<mi->b; ++i) {
-			free(mi->B[i].p);
+			if (mi->mm == 0) free(mi->B[i].p), free(mi->B[i].t), free(mi->B[i].pk);
 			free(mi->B[i].a.a);
-			kh_destroy(idx, (idxhash_t*)mi->B[i].h);
 		}
 	}
 	if (!mi->km) {
@@ -60,25 +106,281 @@ void mm_idx_destroy(mm_idx_t *mi)
 			free(mi->seq[i].name);
 		free(mi->seq);
 	} else km_destroy(mi->km);
-	free(mi->B); free(mi->S); free(mi);
+	if (mi->mm) {
+#ifdef WIN32
+		free(mi->mm);
+#else
+		munmap(mi->mm, mi->mm_len);
+#endif
+	} else free(mi->S), free(mi->bf);
+	free(mi->B); free(mi);
+}
+
+static inline const uint64_t *idx_find(const mm_idx_bucket_t *b, uint64_t key) // the (key, value) entry of _key_ or NULL
+{
+	uint32_t j;
+	const uint64_t *e;
+	if (b->t == 0) return 0;
+	j = flat_slot(key, b->t_mask);
+	while ((e = &b->t[(uint64_t)j<<1])[0] != MM_IDX_FLAT_EMPTY) {
+		if (e[0]>>1 == key>>1) return e;
+		j = (j + 1) & b->t_mask;
+	}
+	return 0;
+}
+
+/****************
+ * Bloom filter *
+ ****************/
+
+// A register-blocked Bloom filter: a minimizer sets MM_IDX_BF_K bits in one 64-bit word, so that a
+// test reads one word. With MM_IDX_BF_BITS bits per minimizer, the false positive rate is ~0.4%.
+
+#define MM_IDX_BF_BITS 16
+#define MM_IDX_BF_K    5
+
+static inline uint64_t bf_word(uint64_t minier, uint64_t n_bf) { return (minier * 0x9E3779B97F4A7C15ULL >> 32) * n_bf >> 32; }
+
+static inline uint64_t bf_mask(uint64_t minier)
+{
+	uint64_t z = (minier ^ minier>>31) * 0xbf58476d1ce4e5b9ULL, m = 0;
+	int i;
+	for (i = 0; i < MM_IDX_BF_K; ++i, z <<= 6)
+		m |= 1ULL << (z>>58);
+	return m;
+}
+
+static inline int bf_test(const mm_idx_t *mi, uint64_t minier) // 0 if _minier_ is absent; 1 if it may be present
+{
+	uint64_t m;
+	if (mi->bf == 0) return 1;
+	m = bf_mask(minier);
+	return (mi->bf[bf_word(minier, mi->n_bf)] & m) == m;
+}
+
+static void worker_bloom(void *g, long i, int tid) // kt_for() callback
+{
+	mm_idx_t *mi = (mm_idx_t*)g;
+	const mm_idx_bucket_t *b = &mi->B[i];
+	uint64_t j;
+	if (b->t == 0) return;
+	for (j = 0; j <= b->t_mask; ++j) {
+		uint64_t minier;
+		if (b->t[j<<1] == MM_IDX_FLAT_EMPTY) continue;
+		minier = b->t[j<<1]>>1<<mi->b | i;
+		__sync_fetch_and_or(&mi->bf[bf_word(minier, mi->n_bf)], bf_mask(minier));
+	}
+}
+
+void mm_idx_bloom(mm_idx_t *mi, int n_threads)
+{
+	uint64_t n_key = 0;
+	uint32_t i;
+	if (mi->mm) return;
+	for (i = 0; i < 1U<<mi->b; ++i)
+		n_key += bucket_n_key(&mi->B[i]);
+	free(mi->bf);
+	mi->n_bf = (n_key * MM_IDX_BF_BITS + 63) / 64;
+	if (mi->n_bf == 0) mi->n_bf = 1;
+	mi->bf = (uint64_t*)calloc(mi->n_bf, 8);
+	kt_for(n_threads, worker_bloom, mi, 1<<mi->b);
+	mi->flag |= MM_I_BLOOM;
+}
+
+/***************************
+ * Packed occurrence lists *
+ ***************************/
+
+// A sorted list of n>1 positions is packed as one byte giving the bit width w0 of the first position
+// and the position in (w0+7)/8 bytes, followed by the n-1 deltas in blocks of MM_IDX_PACK_BLK. Each block starts with one byte giving the bit width w of
+// its deltas, which are then bit-packed; a block with w>56, which only happens when the list
+// crosses reference sequences, stores its deltas in 8 bytes each.
+
+#define MM_IDX_PACK_BLK 16
+
+static inline int pack_width(uint64_t x)
+{
+	int w = 0;
+	while (x) ++w, x >>= 1;
+	return w;
+}
+
+static inline uint64_t pack_ld64(const uint8_t *p) { uint64_t x; memcpy(&x, p, 8); return x; }
+
+static uint64_t pack_list(int n, const uint64_t *p, uint8_t *out) // returns the number of bytes; only counts if out==NULL
+{
+	int i, j, w, m;
+	uint64_t l;
+	w = pack_width(p[0]);
+	if (out) out[0] = w, memcpy(&out[1], p, (w + 7) / 8); // little-endian
+	l = 1 + (w + 7) / 8;
+	for (i = 1; i < n; i += MM_IDX_PACK_BLK) {
+		uint64_t d = 0;
+		m = n - i < MM_IDX_PACK_BLK? n - i : MM_IDX_PACK_BLK;
+		for (j = i; j < i + m; ++j) d |= p[j] - p[j-1];
+		w = pack_width(d);
+		if (w > 56) w = 64;
+		if (out) {
+			out[l] = w;
+			if (w == 64) {
+				for (j = 0; j < m; ++j) {
+					uint64_t x = p[i+j] - p[i+j-1];
+					memcpy(&out[l + 1 + j * 8], &x, 8);
+				}
+			} else {
+				for (j = 0; j < m; ++j) { // out[] is zeroed and has 7 bytes of slack
+					uint64_t o = (uint64_t)j * w, x = pack_ld64(&out[l + 1 + (o>>3)]);
+					x |= (p[i+j] - p[i+j-1]) << (o&7);
+					memcpy(&out[l + 1 + (o>>3)], &x, 8);
+				}
+			}
+		}
+		l += 1 + (m * w + 7) / 8;
+	}
+	return l;
+}
+
+static void unpack_list(int n, const uint8_t *in, uint64_t *p)
+{
+	int i, j, w, m;
+	uint64_t l;
+	w = in[0];
+	p[0] = w? pack_ld64(&in[1]) & (uint64_t)-1 >> (64 - w) : 0;
+	l = 1 + (w + 7) / 8;
+	for (i = 1; i < n; i += MM_IDX_PACK_BLK) {
+		m = n - i < MM_IDX_PACK_BLK? n - i : MM_IDX_PACK_BLK;
+		w = in[l];
+		if (w == 64) {
+			for (j = 0; j < m; ++j)
+				p[i+j] = p[i+j-1] + pack_ld64(&in[l + 1 + j * 8]);
+		} else {
+			uint64_t mask = w? (uint64_t)-1 >> (64 - w) : 0;
+			for (j = 0; j < m; ++j) {
+				uint64_t o = (uint64_t)j * w;
+				p[i+j] = p[i+j-1] + (pack_ld64(&in[l + 1 + (o>>3)]) >> (o&7) & mask);
+			}
+		}
+		l += 1 + (m * w + 7) / 8;
+	}
+}
+
+static void worker_pack(void *g, long i, int tid)
+{
+	mm_idx_t *mi = (mm_idx_t*)g;
+	mm_idx_bucket_t *b = &mi->B[i];
+	uint64_t j, l = 0, l0;
+	if (b->n == 0 || b->pk) return;
+	for (j = 0; j <= b->t_mask; ++j) {
+		uint64_t *e = &b->t[j<<1];
+		if (e[0] == MM_IDX_FLAT_EMPTY || (e[0]&1)) continue;
+		l += pack_list((uint32_t)e[1], &b->p[e[1]>>32], 0);
+	}
+	if (l + 8 > UINT32_MAX) return; // offsets wouldn't fit; leave this bucket unpacked
+	b->pk = (uint8_t*)calloc(l + 8, 1);
+	for (j = 0, l = 0; j <= b->t_mask; ++j) {
+		uint64_t *e = &b->t[j<<1];
+		if (e[0] == MM_IDX_FLAT_EMPTY || (e[0]&1)) continue;
+		l0 = l;
+		l += pack_list((uint32_t)e[1], &b->p[e[1]>>32], &b->pk[l]);
+		e[1] = l0<<32 | (uint32_t)e[1];
+	}
+	b->n_pk = l;
+	free(b->p);
+	b->p = 0;
 }
 
-const uint64_t *mm_idx_get(const mm_idx_t *mi, uint64_t minier, int *n)
+void mm_idx_pack(mm_idx_t *mi, int n_threads)
+{
+	uint32_t i;
+	uint64_t l0 = 0, l1 = 0;
+	if (mi->mm) return; // an mmap()ed index is read-only
+	kt_for(n_threads, worker_pack, mi, 1<<mi->b);
+	for (i = 0; i < 1U<<mi->b; ++i)
+		l0 += (uint64_t)mi->B[i].n * 8, l1 += mi->B[i].pk? mi->B[i].n_pk : (uint64_t)mi->B[i].n * 8;
+	if (mm_verbose >= 3)
+		fprintf(stderr, "[M::%s::%.3f*%.2f] packed occurrence lists from %.1f MB to %.1f MB\n", __func__,
+				realtime() - mm_realtime0, cputime() / (realtime() - mm_realtime0), l0 / 1048576.0, l1 / 1048576.0);
+}
+
+/**********
+ * Lookup *
+ **********/
+
+// A packed list is decoded into *buf, allocated from _km_; the caller frees *buf, which is NULL if nothing was decoded.
+const uint64_t *mm_idx_get(const mm_idx_t *mi, uint64_t minier, int *n, void *km, uint64_t **buf)
 {
 	int mask = (1<<mi->b) - 1;
-	khint_t k;
-	mm_idx_bucket_t *b = &mi->B[minier&mask];
-	idxhash_t *h = (idxhash_t*)b->h;
-	*n = 0;
-	if (h == 0) return 0;
-	k = kh_get(idx, h, minier>>mi->b<<1);
-	if (k == kh_end(h)) return 0;
-	if (kh_key(h, k)&1) { // special casing when there is only one k-mer
+	const mm_idx_bucket_t *b = &mi->B[minier&mask];
+	const uint64_t *e;
+	*n = 0, *buf = 0;
+	if (!bf_test(mi, minier)) return 0;
+	e = idx_find(b, minier>>mi->b<<1);
+	if (e == 0) return 0;
+	if (e[0]&1) { // special casing when there is only one k-mer
 		*n = 1;
-		return &kh_val(h, k);
-	} else {
-		*n = (uint32_t)kh_val(h, k);
-		return &b->p[kh_val(h, k)>>32];
+		return &e[1];
+	}
+	*n = (uint32_t)e[1];
+	if (b->pk) {
+		*buf = (uint64_t*)kmalloc(km, *n * 8);
+		unpack_list(*n, &b->pk[e[1]>>32], *buf);
+		return *buf;
+	}
+	return &b->p[e[1]>>32];
+}
+
+#ifdef __GNUC__
+#define idx_prefetch(p) __builtin_prefetch(p)
+#else
+#define idx_prefetch(p)
+#endif
+
+#define MM_IDX_BATCH 16 // number of lookups in flight
+
+void mm_idx_get_batch(const mm_idx_t *mi, int n, const mm128_t *a, int max_occ, const uint64_t **cr, int *n_occ, void *km, uint64_t **buf)
+{
+	int i, i0, i1, mask = (1<<mi->b) - 1;
+	int64_t n_buf = 0;
+	uint8_t in[MM_IDX_BATCH]; // whether a minimizer passes the Bloom filter
+	*buf = 0;
+	for (i0 = 0; i0 < n; i0 = i1) {
+		i1 = i0 + MM_IDX_BATCH < n? i0 + MM_IDX_BATCH : n;
+		if (mi->bf) {
+			for (i = i0; i < i1; ++i) // filter words
+				idx_prefetch(&mi->bf[bf_word(a[i].x>>8, mi->n_bf)]);
+			for (i = i0; i < i1; ++i)
+				in[i - i0] = bf_test(mi, a[i].x>>8);
+		} else memset(in, 1, i1 - i0);
+		for (i = i0; i < i1; ++i) // bucket entries
+			if (in[i - i0]) idx_prefetch(&mi->B[a[i].x>>8 & mask]);
+		for (i = i0; i < i1; ++i) { // first probed slots
+			const mm_idx_bucket_t *b = &mi->B[a[i].x>>8 & mask];
+			if (in[i - i0] && b->t) idx_prefetch(&b->t[(uint64_t)flat_slot(a[i].x>>8>>mi->b<<1, b->t_mask)<<1]);
+		}
+		for (i = i0; i < i1; ++i) { // resolve; prefetch position arrays to be read by the caller
+			const mm_idx_bucket_t *b = &mi->B[a[i].x>>8 & mask];
+			const uint64_t *e;
+			cr[i] = 0, n_occ[i] = 0;
+			if (!in[i - i0] || (e = idx_find(b, a[i].x>>8>>mi->b<<1)) == 0) continue;
+			if (e[0]&1) {
+				cr[i] = &e[1], n_occ[i] = 1;
+			} else if (b->pk == 0) {
+				cr[i] = &b->p[e[1]>>32], n_occ[i] = (uint32_t)e[1];
+				idx_prefetch(cr[i]);
+			} else if ((n_occ[i] = (uint32_t)e[1]) < max_occ) { // keep the entry; decoded below
+				cr[i] = e, n_buf += n_occ[i];
+				idx_prefetch(&b->pk[e[1]>>32]);
+			}
+		}
+	}
+	if (n_buf == 0) return;
+	*buf = (uint64_t*)kmalloc(km, n_buf * 8);
+	for (i = 0, n_buf = 0; i < n; ++i) {
+		const mm_idx_bucket_t *b = &mi->B[a[i].x>>8 & mask];
+		if (b->pk == 0 || n_occ[i] <= 1 || cr[i] == 0) continue;
+		unpack_list(n_occ[i], &b->pk[cr[i][1]>>32], *buf + n_buf);
+		cr[i] = *buf + n_buf;
+		n_buf += n_occ[i];
 	}
 }
 
@@ -91,40 +393,89 @@ void mm_idx_stat(const mm_idx_t *mi)
 	for (i = 0; i < mi->n_seq; ++i)
 		len += mi->seq[i].len;
 	for (i = 0; i < 1U<<mi->b; ++i)
-		if (mi->B[i].h) n += kh_size((idxhash_t*)mi->B[i].h);
+		n += bucket_n_key(&mi->B[i]);
 	for (i = 0; i < 1U<<mi->b; ++i) {
-		idxhash_t *h = (idxhash_t*)mi->B[i].h;
-		khint_t k;
-		if (h == 0) continue;
-		for (k = 0; k < kh_end(h); ++k)
-			if (kh_exist(h, k)) {
-				sum += kh_key(h, k)&1? 1 : (uint32_t)kh_val(h, k);
-				if (kh_key(h, k)&1) ++n1;
-			}
+		const uint64_t *t = mi->B[i].t;
+		uint64_t j;
+		if (t == 0) continue;
+		for (j = 0; j <= mi->B[i].t_mask; ++j) {
+			if (t[j<<1] == MM_IDX_FLAT_EMPTY) continue;
+			sum += t[j<<1]&1? 1 : (uint32_t)t[j<<1|1];
+			if (t[j<<1]&1) ++n1;
+		}
 	}
 	fprintf(stderr, "[M::%s::%.3f*%.2f] distinct minimizers: %d (%.2f%% are singletons); average occurrences: %.3lf; average spacing: %.3lf\n",
 			__func__, realtime() - mm_realtime0, cputime() / (realtime() - mm_realtime0), n, 100.0*n1/n, (double)sum / n, (double)len / sum);
 }
 
+#include "ksort.h"
+
+typedef struct {
+	const char *name;
+	uint32_t id;
+} name_id_t;
+
+#define name_id_lt(a, b) (strcmp((a).name, (b).name) < 0)
+KSORT_INIT(name, name_id_t, name_id_lt)
+
 int mm_idx_index_name(mm_idx_t *mi)
 {
 	khash_t(str) *h;
-	uint32_t i;
+	name_id_t *a;
+	uint32_t i, r;
 	int has_dup = 0, absent;
-	if (mi->h) return 0;
-	h = kh_init(str);
-	for (i = 0; i < mi->n_seq; ++i) {
-		khint_t k;
-		k = kh_put(str, h, mi->seq[i].name, &absent);
-		if (absent) kh_val(h, k) = i;
-		else has_dup = 1;
-	}
-	mi->h = h;
-	if (has_dup && mm_verbose >= 2)
-		fprintf(stderr, "[WARNING] some database sequences have identical sequence names\n");
+	if (mi->flag & MM_I_NO_NAME) return 0;
+	if (mi->h == 0) {
+		h = kh_init(str);
+		for (i = 0; i < mi->n_seq; ++i) {
+			khint_t k;
+			k = kh_put(str, h, mi->seq[i].name, &absent);
+			if (absent) kh_val(h, k) = i;
+			else has_dup = 1;
+		}
+		mi->h = h;
+		if (has_dup && mm_verbose >= 2)
+			fprintf(stderr, "[WARNING] some database sequences have identical sequence names\n");
+	}
+	if (mi->name_rank) return has_dup;
+	// rank names in the strcmp() order; identical names share a rank
+	a = (name_id_t*)malloc(mi->n_seq * sizeof(name_id_t));
+	for (i = 0; i < mi->n_seq; ++i)
+		a[i].name = mi->seq[i].name, a[i].id = i;
+	if (mi->n_seq > 1) { // heap sort
+		ks_heapmake_name(mi->n_seq, a);
+		for (i = mi->n_seq - 1; i > 0; --i) {
+			name_id_t t = a[0];
+			a[0] = a[i], a[i] = t;
+			ks_heapdown_name(0, i, a);
+		}
+	}
+	mi->name_rank = (uint32_t*)malloc(mi->n_seq * 2 * sizeof(uint32_t));
+	for (i = 0, r = 2; i < mi->n_seq; ++i) {
+		if (i > 0 && strcmp(a[i].name, a[i-1].name) != 0) r += 2;
+		mi->name_rank[a[i].id] = r;
+		mi->name_rank[mi->n_seq + i] = a[i].id;
+	}
+	free(a);
 	return has_dup;
 }
 
+uint32_t mm_idx_name_rank(const mm_idx_t *mi, const char *name)
+{
+	khash_t(str) *h = (khash_t(str)*)mi->h;
+	const uint32_t *ord = mi->name_rank + mi->n_seq;
+	uint32_t lo = 0, hi = mi->n_seq;
+	khint_t k;
+	k = kh_get(str, h, name);
+	if (k != kh_end(h)) return mi->name_rank[kh_val(h, k)];
+	while (lo < hi) { // the first name greater than _name_
+		uint32_t mid = lo + ((hi - lo) >> 1);
+		if (strcmp(mi->seq[ord[mid]].name, name) < 0) lo = mid + 1;
+		else hi = mid;
+	}
+	return lo < mi->n_seq? mi->name_rank[ord[lo]] - 1 : (mi->n_seq? mi->name_rank[ord[mi->n_seq - 1]] : 0) + 1;
+}
+
 int mm_idx_name2id(const mm_idx_t *mi, const char *name)
 {
 	khash_t(str) *h = (khash_t(str)*)mi->h;
@@ -134,6 +485,55 @@ int mm_idx_name2id(const mm_idx_t *mi, const char *name)
 	return k == kh_end(h)? -1 : kh_val(h, k);
 }
 
+mm_idx_t *mm_idx_dup(const mm_idx_t *mi)
+{
+	uint32_t i;
+	uint64_t sum_len = 0;
+	mm_idx_t *r;
+	r = mm_idx_init(mi->w, mi->k, mi->b, mi->flag);
+	r->index = mi->index, r->n_seq = mi->n_seq;
+	r->seq = (mm_idx_seq_t*)kcalloc(r->km, r->n_seq, sizeof(mm_idx_seq_t));
+	for (i = 0; i < r->n_seq; ++i) {
+		r->seq[i] = mi->seq[i];
+		if (mi->seq[i].name) {
+			r->seq[i].name = (char*)kmalloc(r->km, strlen(mi->seq[i].name) + 1);
+			strcpy(r->seq[i].name, mi->seq[i].name);
+		}
+		sum_len += mi->seq[i].len;
+	}
+	if (mi->h) { // as in mm_idx_index_name()
+		khash_t(str) *h;
+		int absent;
+		r->h = h = kh_init(str);
+		for (i = 0; i < r->n_seq; ++i) {
+			khint_t k = kh_put(str, h, r->seq[i].name, &absent);
+			if (absent) kh_val(h, k) = i;
+		}
+	}
+	if (mi->name_rank) {
+		r->name_rank = (uint32_t*)malloc(mi->n_seq * 2 * sizeof(uint32_t));
+		memcpy(r->name_rank, mi->name_rank, mi->n_seq * 2 * sizeof(uint32_t));
+	}
+	for (i = 0; i < 1U<<mi->b; ++i) {
+		const mm_idx_bucket_t *b = &mi->B[i];
+		mm_idx_bucket_t *c = &r->B[i];
+		c->n = b->n, c->n_pk = b->n_pk, c->t_mask = b->t_mask;
+		if (b->t) c->t = (uint64_t*)malloc((b->t_mask + 1ULL) * 16), memcpy(c->t, b->t, (b->t_mask + 1ULL) * 16);
+		if (b->p) c->p = (uint64_t*)malloc(b->n * 8), memcpy(c->p, b->p, b->n * 8);
+		if (b->pk) c->pk = (uint8_t*)malloc(b->n_pk + 8), memcpy(c->pk, b->pk, b->n_pk + 8);
+	}
+	if (mi->S) {
+		r->S = (uint32_t*)malloc((sum_len + 7) / 8 * 4);
+		memcpy(r->S, mi->S, (sum_len + 7) / 8 * 4);
+	}
+	if (mi->bf) {
+		r->n_bf = mi->n_bf;
+		r->bf = (uint64_t*)malloc(mi->n_bf * 8);
+		memcpy(r->bf, mi->bf, mi->n_bf * 8);
+	}
+	return r;
+}
+
 int mm_idx_getseq(const mm_idx_t *mi, uint32_t rid, uint32_t st, uint32_t en, uint8_t *seq)
 {
 	uint64_t i, st1, en1;
@@ -141,7 +541,21 @@ int mm_idx_getseq(const mm_idx_t *mi, uint32_t rid, uint32_t st, uint32_t en, ui
 	if (en > mi->seq[rid].len) en = mi->seq[rid].len;
 	st1 = mi->seq[rid].offset + st;
 	en1 = mi->seq[rid].offset + en;
-	for (i = st1; i < en1; ++i)
+	for (i = st1; i < en1 && i & 7; ++i)
+		seq[i - st1] = mm_seq4_get(mi->S, i);
+#ifdef __SSE2__
+	for (; i + 16 <= en1; i += 16) { // the reverse of mm_seq4_pack(), 16 bases at a time
+		__m128i v = _mm_loadl_epi64((const __m128i*)&mi->S[i >> 3]), m = _mm_set1_epi8(0xf);
+		v = _mm_unpacklo_epi8(_mm_and_si128(v, m), _mm_and_si128(_mm_srli_epi16(v, 4), m)); // low nibble first
+		_mm_storeu_si128((__m128i*)&seq[i - st1], v);
+	}
+#endif
+	for (; i + 8 <= en1; i += 8) {
+		uint32_t x = mi->S[i >> 3], k;
+		for (k = 0; k < 8; ++k, x >>= 4)
+			seq[i - st1 + k] = x & 0xf;
+	}
+	for (; i < en1; ++i)
 		seq[i - st1] = mm_seq4_get(mi->S, i);
 	return en - st;
 }
@@ -150,19 +564,18 @@ int32_t mm_idx_cal_max_occ(const mm_idx_t *mi, float f)
 {
 	int i;
 	size_t n = 0;
-	uint32_t thres;
-	khint_t *a, k;
+	uint32_t thres, *a;
 	if (f <= 0.) return INT32_MAX;
 	for (i = 0; i < 1<<mi->b; ++i)
-		if (mi->B[i].h) n += kh_size((idxhash_t*)mi->B[i].h);
+		n += bucket_n_key(&mi->B[i]);
 	a = (uint32_t*)malloc(n * 4);
 	for (i = n = 0; i < 1<<mi->b; ++i) {
-		idxhash_t *h = (idxhash_t*)mi->B[i].h;
-		if (h == 0) continue;
-		for (k = 0; k < kh_end(h); ++k) {
-			if (!kh_exist(h, k)) continue;
-			a[n++] = kh_key(h, k)&1? 1 : (uint32_t)kh_val(h, k);
-		}
+		const uint64_t *t = mi->B[i].t;
+		uint64_t j;
+		if (t == 0) continue;
+		for (j = 0; j <= mi->B[i].t_mask; ++j)
+			if (t[j<<1] != MM_IDX_FLAT_EMPTY)
+				a[n++] = t[j<<1]&1? 1 : (uint32_t)t[j<<1|1];
 	}
 	thres = ks_ksmall_uint32_t(n, a, (uint32_t)((1. - f) * n)) + 1;
 	free(a);
@@ -177,7 +590,6 @@ static void worker_post(void *g, long i, int tid)
 {
 	int n, n_keys;
 	size_t j, start_a, start_p;
-	idxhash_t *h;
 	mm_idx_t *mi = (mm_idx_t*)g;
 	mm_idx_bucket_t *b = &mi->B[i];
 	if (b->a.n == 0) return;
@@ -193,33 +605,27 @@ static void worker_post(void *g, long i, int tid)
 			n = 1;
 		} else ++n;
 	}
-	h = kh_init(idx);
-	kh_resize(idx, h, n_keys);
+	bucket_alloc(b, n_keys);
 	b->p = (uint64_t*)calloc(b->n, 8);
 
 	// create the hash table
 	for (j = 1, n = 1, start_a = start_p = 0; j <= b->a.n; ++j) {
 		if (j == b->a.n || b->a.a[j].x>>8 != b->a.a[j-1].x>>8) {
-			khint_t itr;
-			int absent;
 			mm128_t *p = &b->a.a[j-1];
-			itr = kh_put(idx, h, p->x>>8>>mi->b<<1, &absent);
-			assert(absent && j == start_a + n);
+			assert(j == start_a + n);
 			if (n == 1) {
-				kh_key(h, itr) |= 1;
-				kh_val(h, itr) = p->y;
+				flat_put(b->t, b->t_mask, p->x>>8>>mi->b<<1|1, p->y);
 			} else {
 				int k;
 				for (k = 0; k < n; ++k)
 					b->p[start_p + k] = b->a.a[start_a + k].y;
 				radix_sort_64(&b->p[start_p], &b->p[start_p + n]); // sort by position; needed as in-place radix_sort_128x() is not stable
-				kh_val(h, itr) = (uint64_t)start_p<<32 | n;
+				flat_put(b->t, b->t_mask, p->x>>8>>mi->b<<1, (uint64_t)start_p<<32 | n);
 				start_p += n;
 			}
 			start_a = j, n = 1;
 		} else ++n;
 	}
-	b->h = h;
 	assert(b->n == (int32_t)start_p);
 
 	// deallocate and clear b->a
@@ -232,6 +638,65 @@ static void mm_idx_post(mm_idx_t *mi, int n_threads)
 	kt_for(n_threads, worker_post, mi, 1<<mi->b);
 }
 
+static void worker_merge(void *g, long i, int tid) // merge b->a into an existing bucket; the result is the same as worker_post() on all minimizers
+{
+	mm_idx_t *mi = (mm_idx_t*)g;
+	mm_idx_bucket_t *b = &mi->B[i];
+	mm128_t *e;
+	uint64_t *t = 0, *p = 0, j, k, l, n_e, n_key = 0, n_p = 0, m = 0;
+	int pass;
+	if (b->a.n == 0) return;
+
+	// sort new minimizers by key and existing keys likewise; new positions are larger as their sequences come later
+	radix_sort_128x(b->a.a, b->a.a + b->a.n);
+	for (j = 0; j < b->a.n; ++j)
+		b->a.a[j].x = b->a.a[j].x>>8>>mi->b<<1;
+	n_e = bucket_n_key(b);
+	e = (mm128_t*)malloc((n_e + 1) * sizeof(mm128_t));
+	for (j = k = 0; j < n_e; ++k)
+		if (b->t[k<<1] != MM_IDX_FLAT_EMPTY)
+			e[j].x = b->t[k<<1], e[j++].y = b->t[k<<1|1];
+	radix_sort_128x(e, e + n_e);
+
+	// count in the first pass; fill _t_ and _p_ in the second
+	for (pass = 0; pass < 2; ++pass) {
+		if (pass == 1) {
+			m = flat_size(n_key);
+			t = (uint64_t*)malloc(m * 16);
+			memset(t, 0xff, m * 16);
+			p = (uint64_t*)malloc(n_p * 8);
+			n_p = 0;
+		}
+		for (j = k = 0; j < n_e || k < b->a.n;) {
+			uint64_t key, n_old = 0;
+			key = j == n_e || (k < b->a.n && b->a.a[k].x < e[j].x>>1<<1)? b->a.a[k].x : e[j].x>>1<<1;
+			if (j < n_e && e[j].x>>1<<1 == key)
+				n_old = e[j].x&1? 1 : (uint32_t)e[j].y;
+			for (l = k; l < b->a.n && b->a.a[l].x == key; ++l);
+			if (pass == 0) {
+				++n_key;
+				if (n_old + (l - k) > 1) n_p += n_old + (l - k);
+			} else if (n_old + (l - k) == 1) {
+				flat_put(t, m - 1, key|1, n_old? e[j].y : b->a.a[k].y);
+			} else {
+				uint64_t st = n_p;
+				if (n_old == 1) p[n_p++] = e[j].y;
+				else if (n_old > 1) memcpy(&p[n_p], &b->p[e[j].y>>32], n_old * 8), n_p += n_old;
+				for (; k < l; ++k) p[n_p++] = b->a.a[k].y;
+				radix_sort_64(&p[st + n_old], &p[n_p]);
+				flat_put(t, m - 1, key, st<<32 | (n_p - st));
+			}
+			if (n_old) ++j;
+			k = l;
+		}
+	}
+	free(e);
+	free(b->t); free(b->p);
+	b->t = t, b->t_mask = m - 1, b->p = p, b->n = n_p;
+	kfree(0, b->a.a);
+	b->a.n = b->a.m = 0, b->a.a = 0;
+}
+
 /******************
  * Generate index *
  ******************/
@@ -241,18 +706,95 @@ static void mm_idx_post(mm_idx_t *mi, int n_threads)
 #include "bseq.h"
 
 typedef struct {
-	int mini_batch_size;
+	int mini_batch_size, n_threads;
 	uint64_t batch_size, sum_len;
 	mm_bseq_file_t *fp;
 	mm_idx_t *mi;
+	int64_t *cnt; // per-chunk bucket counts, then write positions; n_threads<<b; kept across batches
 } pipeline_t;
 
 typedef struct {
-    int n_seq;
+	const pipeline_t *p;
+    int n_seq, n_chunk;
 	mm_bseq1_t *seq;
-	mm128_v a;
+	int *chunk; // sequences chunk[c] to chunk[c+1]-1 are sketched together
+	mm128_v a, *sa; // _sa_ keeps the minimizers of each chunk before they are concatenated to _a_
 } step_t;
 
+static void mm_seq4_pack(uint32_t *S, uint64_t o, uint32_t len, const char *seq) // S[] must be zeroed
+{
+	uint32_t j = 0, k;
+	for (; j < len && (o + j) & 7; ++j)
+		mm_seq4_set(S, o + j, seq_nt4_table[(uint8_t)seq[j]]);
+#ifdef __SSE2__
+	for (; j + 16 <= len; j += 16) { // the same as seq_nt4_table[], 16 bases at a time
+		__m128i v = _mm_loadu_si128((const __m128i*)&seq[j]), u, c, any, r;
+		u = _mm_and_si128(v, _mm_set1_epi8((char)0xdf)); // to upper case
+		any = c = _mm_cmpeq_epi8(_mm_min_epu8(v, _mm_set1_epi8(3)), v); // bytes 0-3 are kept
+		r = _mm_and_si128(c, v);
+		any = _mm_or_si128(any, _mm_cmpeq_epi8(u, _mm_set1_epi8('A')));
+		c = _mm_cmpeq_epi8(u, _mm_set1_epi8('C')), any = _mm_or_si128(any, c), r = _mm_or_si128(r, _mm_and_si128(c, _mm_set1_epi8(1)));
+		c = _mm_cmpeq_epi8(u, _mm_set1_epi8('G')), any = _mm_or_si128(any, c), r = _mm_or_si128(r, _mm_and_si128(c, _mm_set1_epi8(2)));
+		c = _mm_or_si128(_mm_cmpeq_epi8(u, _mm_set1_epi8('T')), _mm_cmpeq_epi8(u, _mm_set1_epi8('U')));
+		any = _mm_or_si128(any, c), r = _mm_or_si128(r, _mm_and_si128(c, _mm_set1_epi8(3)));
+		r = _mm_or_si128(r, _mm_andnot_si128(any, _mm_set1_epi8(4)));
+		r = _mm_or_si128(_mm_and_si128(r, _mm_set1_epi16(0xff)), _mm_slli_epi16(_mm_srli_epi16(r, 8), 4)); // two bases per byte
+		_mm_storel_epi64((__m128i*)&S[(o + j) >> 3], _mm_packus_epi16(r, r));
+	}
+#endif
+	for (; j + 8 <= len; j += 8) {
+		uint32_t x = 0;
+		for (k = 0; k < 8; ++k)
+			x |= (uint32_t)seq_nt4_table[(uint8_t)seq[j + k]] << (k<<2);
+		S[(o + j) >> 3] = x;
+	}
+	for (; j < len; ++j)
+		mm_seq4_set(S, o + j, seq_nt4_table[(uint8_t)seq[j]]);
+}
+
+static void worker_sketch(void *g, long c, int tid) // kt_for() callback
+{
+	step_t *s = (step_t*)g;
+	mm_idx_t *mi = s->p->mi;
+	int i, st = s->chunk[c], en = s->chunk[c + 1];
+	const char **seqs;
+	int *lens;
+	seqs = (const char**)calloc(en - st, sizeof(char*));
+	lens = (int*)calloc(en - st, sizeof(int));
+	for (i = st; i < en; ++i) {
+		mm_bseq1_t *t = &s->seq[i];
+		seqs[i - st] = t->seq, lens[i - st] = t->l_seq;
+		if (t->l_seq == 0 && mm_verbose >= 2)
+			fprintf(stderr, "[WARNING] the length database sequence '%s' is 0\n", t->name);
+	}
+	mm_sketch_batch(0, en - st, seqs, lens, s->seq[st].rid, mi->w, mi->k, mi->flag&MM_I_HPC, 0, 0, &s->sa[c], 0);
+	for (i = st; i < en; ++i) {
+		free(s->seq[i].seq); free(s->seq[i].name);
+	}
+	free(seqs); free(lens);
+}
+
+static void worker_count(void *g, long c, int tid) // kt_for() callback
+{
+	step_t *s = (step_t*)g;
+	int64_t i, *cnt = &s->p->cnt[c << s->p->mi->b], mask = (1<<s->p->mi->b) - 1;
+	int64_t st = s->a.n * c / s->n_chunk, en = s->a.n * (c + 1) / s->n_chunk;
+	for (i = st; i < en; ++i)
+		++cnt[s->a.a[i].x>>8 & mask];
+}
+
+static void worker_scatter(void *g, long c, int tid) // kt_for() callback
+{
+	step_t *s = (step_t*)g;
+	mm_idx_bucket_t *B = s->p->mi->B;
+	int64_t i, *cnt = &s->p->cnt[c << s->p->mi->b], mask = (1<<s->p->mi->b) - 1;
+	int64_t st = s->a.n * c / s->n_chunk, en = s->a.n * (c + 1) / s->n_chunk;
+	for (i = st; i < en; ++i) {
+		int64_t j = s->a.a[i].x>>8 & mask;
+		B[j].a.a[cnt[j]++] = s->a.a[i];
+	}
+}
+
 static void mm_idx_add(mm_idx_t *mi, int n, const mm128_t *a)
 {
 	int i, mask = (1<<mi->b) - 1;
@@ -262,6 +804,29 @@ static void mm_idx_add(mm_idx_t *mi, int n, const mm128_t *a)
 	}
 }
 
+static void mm_idx_dispatch(step_t *s) // mm_idx_add() in parallel: count, then scatter, keeping the order within a bucket
+{
+	mm_idx_t *mi = s->p->mi;
+	int64_t c, j, n_b = 1<<mi->b, *cnt = s->p->cnt;
+	s->n_chunk = s->a.n < (size_t)s->p->n_threads * 65536? 1 : s->p->n_threads;
+	memset(cnt, 0, s->n_chunk * n_b * sizeof(int64_t));
+	kt_for(s->n_chunk, worker_count, s, s->n_chunk);
+	for (j = 0; j < n_b; ++j) {
+		mm128_v *a = &mi->B[j].a;
+		size_t n = a->n;
+		for (c = 0; c < s->n_chunk; ++c) {
+			int64_t t = cnt[c * n_b + j];
+			cnt[c * n_b + j] = n, n += t;
+		}
+		if (n > a->m) {
+			while (a->m < n) a->m = a->m? a->m<<1 : 2; // as kv_push()
+			a->a = (mm128_t*)krealloc(0, a->a, a->m * sizeof(mm128_t));
+		}
+		a->n = n;
+	}
+	kt_for(s->n_chunk, worker_scatter, s, s->n_chunk);
+}
+
 static void *worker_pipeline(void *shared, int step, void *in)
 {
 	int i;
@@ -294,7 +859,6 @@ static void *worker_pipeline(void *shared, int step, void *in)
 			// populate p->mi->seq
 			for (i = 0; i < s->n_seq; ++i) {
 				mm_idx_seq_t *seq = &p->mi->seq[p->mi->n_seq];
-				uint32_t j;
 				if (!(p->mi->flag & MM_I_NO_NAME)) {
 					seq->name = (char*)kmalloc(p->mi->km, strlen(s->seq[i].name) + 1);
 					strcpy(seq->name, s->seq[i].name);
@@ -302,13 +866,8 @@ static void *worker_pipeline(void *shared, int step, void *in)
 				seq->len = s->seq[i].l_seq;
 				seq->offset = p->sum_len;
 				// copy the sequence
-				if (!(p->mi->flag & MM_I_NO_SEQ)) {
-					for (j = 0; j < seq->len; ++j) { // TODO: this is not the fastest way, but let's first see if speed matters here
-						uint64_t o = p->sum_len + j;
-						int c = seq_nt4_table[(uint8_t)s->seq[i].seq[j]];
-						mm_seq4_set(p->mi->S, o, c);
-					}
-				}
+				if (!(p->mi->flag & MM_I_NO_SEQ))
+					mm_seq4_pack(p->mi->S, p->sum_len, seq->len, s->seq[i].seq);
 				// update p->sum_len and p->mi->n_seq
 				p->sum_len += seq->len;
 				s->seq[i].rid = p->mi->n_seq++;
@@ -317,43 +876,75 @@ static void *worker_pipeline(void *shared, int step, void *in)
 		} else free(s);
     } else if (step == 1) { // step 1: compute sketch
         step_t *s = (step_t*)in;
-		for (i = 0; i < s->n_seq; ++i) {
-			mm_bseq1_t *t = &s->seq[i];
-			if (t->l_seq > 0)
-				mm_sketch(0, t->seq, t->l_seq, p->mi->w, p->mi->k, t->rid, p->mi->flag&MM_I_HPC, &s->a);
-			else if (mm_verbose >= 2)
-				fprintf(stderr, "[WARNING] the length database sequence '%s' is 0\n", t->name);
-			free(t->seq); free(t->name);
+		uint64_t sum_len, len, max_len;
+		size_t n;
+		int c, n_chunk;
+		s->p = p;
+		// group short sequences into chunks of similar total length, about four per thread
+		for (i = 0, sum_len = 0; i < s->n_seq; ++i) sum_len += s->seq[i].l_seq;
+		max_len = sum_len / (p->n_threads * 4) + 1;
+		s->chunk = (int*)malloc((s->n_seq + 1) * sizeof(int));
+		for (i = 0, n_chunk = 0, len = max_len; i < s->n_seq; ++i) {
+			if (len >= max_len) s->chunk[n_chunk++] = i, len = 0;
+			len += s->seq[i].l_seq;
 		}
+		s->chunk[n_chunk] = s->n_seq;
+		s->sa = (mm128_v*)calloc(n_chunk, sizeof(mm128_v));
+		kt_for(p->n_threads, worker_sketch, s, n_chunk);
+		if (n_chunk == 1) { // typical of chromosomes; no copying
+			s->a = s->sa[0];
+		} else {
+			for (c = 0, n = 0; c < n_chunk; ++c) n += s->sa[c].n;
+			kv_resize(mm128_t, 0, s->a, n);
+			for (c = 0; c < n_chunk; ++c) {
+				memcpy(&s->a.a[s->a.n], s->sa[c].a, s->sa[c].n * sizeof(mm128_t));
+				s->a.n += s->sa[c].n;
+				kfree(0, s->sa[c].a);
+			}
+		}
+		free(s->chunk); s->chunk = 0;
+		free(s->sa); s->sa = 0;
 		free(s->seq); s->seq = 0;
 		return s;
     } else if (step == 2) { // dispatch sketch to buckets
         step_t *s = (step_t*)in;
-		mm_idx_add(p->mi, s->a.n, s->a.a);
+		mm_idx_dispatch(s);
 		kfree(0, s->a.a); free(s);
 	}
     return 0;
 }
 
-mm_idx_t *mm_idx_gen(mm_bseq_file_t *fp, int w, int k, int b, int flag, int mini_batch_size, int n_threads, uint64_t batch_size)
+static void mm_idx_collect(mm_idx_t *mi, mm_bseq_file_t *fp, uint64_t sum_len, int mini_batch_size, int n_threads, uint64_t batch_size) // add sequences and bucket their minimizers to mi->B[].a
 {
 	pipeline_t pl;
-	if (fp == 0 || mm_bseq_eof(fp)) return 0;
 	memset(&pl, 0, sizeof(pipeline_t));
 	pl.mini_batch_size = (uint64_t)mini_batch_size < batch_size? mini_batch_size : batch_size;
 	pl.batch_size = batch_size;
+	pl.sum_len = sum_len;
 	pl.fp = fp;
-	pl.mi = mm_idx_init(w, k, b, flag);
-
+	pl.n_threads = n_threads > 1? n_threads : 1;
+	pl.mi = mi;
+	pl.cnt = (int64_t*)malloc(((int64_t)pl.n_threads << mi->b) * sizeof(int64_t));
 	kt_pipeline(n_threads < 3? n_threads : 3, worker_pipeline, &pl, 3);
+	free(pl.cnt);
+}
+
+mm_idx_t *mm_idx_gen(mm_bseq_file_t *fp, int w, int k, int b, int flag, int mini_batch_size, int n_threads, uint64_t batch_size)
+{
+	mm_idx_t *mi;
+	if (fp == 0 || mm_bseq_eof(fp)) return 0;
+	mi = mm_idx_init(w, k, b, flag);
+	mm_idx_collect(mi, fp, 0, mini_batch_size, n_threads, batch_size);
 	if (mm_verbose >= 3)
 		fprintf(stderr, "[M::%s::%.3f*%.2f] collected minimizers\n", __func__, realtime() - mm_realtime0, cputime() / (realtime() - mm_realtime0));
 
-	mm_idx_post(pl.mi, n_threads);
+	mm_idx_post(mi, n_threads);
 	if (mm_verbose >= 3)
 		fprintf(stderr, "[M::%s::%.3f*%.2f] sorted minimizers\n", __func__, realtime() - mm_realtime0, cputime() / (realtime() - mm_realtime0));
 
-	return pl.mi;
+	if (flag & MM_I_BLOOM) mm_idx_bloom(mi, n_threads);
+
+	return mi;
 }
 
 mm_idx_t *mm_idx_build(const char *fn, int w, int k, int flag, int n_threads) // a simpler interface; deprecated
@@ -389,7 +980,6 @@ mm_idx_t *mm_idx_str(int w, int k, int is_hpc, int bucket_bits, int n, const cha
 	for (i = 0, sum_len = 0; i < n; ++i) {
 		const char *s = seq[i];
 		mm_idx_seq_t *p = &mi->seq[i];
-		uint32_t j;
 		if (name && name[i]) {
 			int absent;
 			p->name = (char*)kmalloc(mi->km, strlen(name[i]) + 1);
@@ -399,11 +989,7 @@ mm_idx_t *mm_idx_str(int w, int k, int is_hpc, int bucket_bits, int n, const cha
 		}
 		p->offset = sum_len;
 		p->len = strlen(s);
-		for (j = 0; j < p->len; ++j) {
-			int c = seq_nt4_table[(uint8_t)s[j]];
-			uint64_t o = sum_len + j;
-			mm_seq4_set(mi->S, o, c);
-		}
+		mm_seq4_pack(mi->S, sum_len, p->len, s);
 		sum_len += p->len;
 		if (p->len > 0) {
 			a.n = 0;
@@ -416,6 +1002,78 @@ mm_idx_t *mm_idx_str(int w, int k, int is_hpc, int bucket_bits, int n, const cha
 	return mi;
 }
 
+static void idx_unmap(mm_idx_t *mi) // copy an mmap()ed index to memory so that it can be modified
+{
+	uint32_t i;
+	uint64_t sum_len = 0;
+	if (mi->mm == 0) return;
+	for (i = 0; i < 1U<<mi->b; ++i) {
+		mm_idx_bucket_t *b = &mi->B[i];
+		const uint64_t *t = b->t, *p = b->p;
+		if (t) b->t = (uint64_t*)malloc((b->t_mask + 1ULL) * 16), memcpy(b->t, t, (b->t_mask + 1ULL) * 16);
+		b->p = (uint64_t*)malloc(b->n * 8), memcpy(b->p, p, b->n * 8);
+	}
+	for (i = 0; i < mi->n_seq; ++i)
+		sum_len += mi->seq[i].len;
+	if (mi->S) {
+		const uint32_t *S = mi->S;
+		mi->S = (uint32_t*)malloc((sum_len + 7) / 8 * 4);
+		memcpy(mi->S, S, (sum_len + 7) / 8 * 4);
+	}
+	if (mi->bf) {
+		const uint64_t *bf = mi->bf;
+		mi->bf = (uint64_t*)malloc(mi->n_bf * 8);
+		memcpy(mi->bf, bf, mi->n_bf * 8);
+	}
+#ifdef WIN32
+	free(mi->mm);
+#else
+	munmap(mi->mm, mi->mm_len);
+#endif
+	mi->mm = 0, mi->mm_len = 0;
+}
+
+int mm_idx_append(mm_idx_t *mi, const char *fn, int mini_batch_size, int n_threads)
+{
+	mm_bseq_file_t *fp;
+	uint32_t i, n_seq0 = mi->n_seq, m;
+	uint64_t sum_len = 0, max_len;
+
+	for (i = 0; i < 1U<<mi->b; ++i)
+		if (mi->B[i].pk) return -1; // packed occurrence lists can't be merged
+	fp = mm_bseq_open(fn);
+	if (fp == 0) return -1;
+	idx_unmap(mi);
+
+	// give mi->seq and mi->S the capacities that worker_pipeline() assumes
+	m = mi->n_seq;
+	kroundup32(m);
+	if (m > mi->n_seq)
+		mi->seq = (mm_idx_seq_t*)krealloc(mi->km, mi->seq, m * sizeof(mm_idx_seq_t));
+	for (i = 0; i < mi->n_seq; ++i)
+		sum_len += mi->seq[i].len;
+	if (!(mi->flag & MM_I_NO_SEQ)) {
+		max_len = (sum_len + 7) / 8;
+		kroundup64(max_len);
+		mi->S = (uint32_t*)realloc(mi->S, max_len * 4);
+		memset(&mi->S[(sum_len + 7) / 8], 0, (max_len - (sum_len + 7) / 8) * 4);
+	}
+
+	mm_idx_collect(mi, fp, sum_len, mini_batch_size, n_threads, UINT64_MAX);
+	mm_bseq_close(fp);
+	kt_for(n_threads, worker_merge, mi, 1<<mi->b);
+	if (mi->flag & MM_I_BLOOM) mm_idx_bloom(mi, n_threads);
+	if (mi->h) { // re-index names
+		kh_destroy(str, (khash_t(str)*)mi->h);
+		free(mi->name_rank);
+		mi->h = 0, mi->name_rank = 0;
+		mm_idx_index_name(mi);
+	}
+	if (mm_verbose >= 3)
+		fprintf(stderr, "[M::%s::%.3f*%.2f] appended %d sequence(s)\n", __func__, realtime() - mm_realtime0, cputime() / (realtime() - mm_realtime0), mi->n_seq - n_seq0);
+	return mi->n_seq - n_seq0;
+}
+
 /*************
  * index I/O *
  *************/
@@ -442,26 +1100,167 @@ void mm_idx_dump(FILE *fp, const mm_idx_t *mi)
 	}
 	for (i = 0; i < 1<<mi->b; ++i) {
 		mm_idx_bucket_t *b = &mi->B[i];
-		khint_t k;
-		idxhash_t *h = (idxhash_t*)b->h;
-		uint32_t size = h? h->size : 0;
+		uint32_t size = bucket_n_key(b);
+		uint64_t j;
+		assert(b->pk == 0); // mm_idx_pack() must come after dumping
 		fwrite(&b->n, 4, 1, fp);
 		fwrite(b->p, 8, b->n, fp);
 		fwrite(&size, 4, 1, fp);
 		if (size == 0) continue;
-		for (k = 0; k < kh_end(h); ++k) {
-			uint64_t x[2];
-			if (!kh_exist(h, k)) continue;
-			x[0] = kh_key(h, k), x[1] = kh_val(h, k);
-			fwrite(x, 8, 2, fp);
-		}
+		for (j = 0; j <= b->t_mask; ++j)
+			if (b->t[j<<1] != MM_IDX_FLAT_EMPTY)
+				fwrite(&b->t[j<<1], 8, 2, fp);
 	}
 	if (!(mi->flag & MM_I_NO_SEQ))
 		fwrite(mi->S, 4, (sum_len + 7) / 8, fp);
+	// the Bloom filter is not saved, so that older versions can read the index; MM_I_BLOOM in the flag has it rebuilt on loading
 	fflush(fp);
 }
 
-mm_idx_t *mm_idx_load(FILE *fp)
+/* Layout of one part in the flat format; all offsets are relative to the start of the part:
+ *
+ *   magic, uint32_t x[5] = {w, k, b, n_seq, flag}
+ *   uint64_t y[3] = {length of the part, offset of the bucket directory, offset of S or 0}
+ *   for each sequence: uint8_t name length, name, uint32_t length (as in mm_idx_dump())
+ *   bucket directory: uint64_t {offset of p, n, offset of the table, table size} for each bucket
+ *   for each bucket: p[n]; table of (key, value) pairs, open addressing with linear probing
+ *   S
+ *   with MM_I_BLOOM: uint64_t number of words, Bloom filter
+ *
+ * Sections are 8-byte aligned and a part is padded to a multiple of 8 bytes.
+ */
+static void flat_pad(FILE *fp, uint64_t l)
+{
+	static const uint8_t zero[8] = {0,0,0,0,0,0,0,0};
+	if (l & 7) fwrite(zero, 1, 8 - (l & 7), fp);
+}
+
+void mm_idx_dump_flat(FILE *fp, const mm_idx_t *mi)
+{
+	uint64_t sum_len = 0, off, y[3], *dir;
+	uint32_t x[5], i, n_b = 1U<<mi->b;
+
+	off = MM_IDX_FLAT_HDR;
+	for (i = 0; i < mi->n_seq; ++i) {
+		off += 5 + (mi->seq[i].name? (uint8_t)strlen(mi->seq[i].name) : 0);
+		sum_len += mi->seq[i].len;
+	}
+	off = (off + 7) & ~7ULL;
+	y[1] = off;
+	off += (uint64_t)n_b * 32;
+	dir = (uint64_t*)calloc((size_t)n_b * 4, 8);
+	for (i = 0; i < n_b; ++i) {
+		const mm_idx_bucket_t *b = &mi->B[i];
+		dir[i<<2|0] = off, dir[i<<2|1] = b->n;
+		off += (uint64_t)b->n * 8;
+		dir[i<<2|2] = off, dir[i<<2|3] = b->t? b->t_mask + 1ULL : 0;
+		off += dir[i<<2|3] * 16;
+	}
+	y[2] = mi->flag & MM_I_NO_SEQ? 0 : off;
+	if (!(mi->flag & MM_I_NO_SEQ))
+		off += ((sum_len + 7) / 8 * 4 + 7) & ~7ULL;
+	if (mi->flag & MM_I_BLOOM)
+		off += 8 + mi->n_bf * 8;
+	y[0] = off;
+
+	x[0] = mi->w, x[1] = mi->k, x[2] = mi->b, x[3] = mi->n_seq, x[4] = mi->flag;
+	fwrite(MM_IDX_MAGIC_FLAT, 1, 4, fp);
+	fwrite(x, 4, 5, fp);
+	fwrite(y, 8, 3, fp);
+	for (i = 0, off = MM_IDX_FLAT_HDR; i < mi->n_seq; ++i) {
+		uint8_t l = mi->seq[i].name? strlen(mi->seq[i].name) : 0;
+		fwrite(&l, 1, 1, fp);
+		fwrite(mi->seq[i].name, 1, l, fp);
+		fwrite(&mi->seq[i].len, 4, 1, fp);
+		off += 5 + l;
+	}
+	flat_pad(fp, off);
+	fwrite(dir, 8, (size_t)n_b * 4, fp);
+	for (i = 0; i < n_b; ++i) {
+		const mm_idx_bucket_t *b = &mi->B[i];
+		assert(b->pk == 0); // mm_idx_pack() must come after dumping
+		fwrite(b->p, 8, b->n, fp);
+		fwrite(b->t, 16, dir[i<<2|3], fp);
+	}
+	if (!(mi->flag & MM_I_NO_SEQ)) {
+		fwrite(mi->S, 4, (sum_len + 7) / 8, fp);
+		flat_pad(fp, (sum_len + 7) / 8 * 4);
+	}
+	if (mi->flag & MM_I_BLOOM) {
+		fwrite(&mi->n_bf, 8, 1, fp);
+		fwrite(mi->bf, 8, mi->n_bf, fp);
+	}
+	fflush(fp);
+	free(dir);
+}
+
+static mm_idx_t *mm_idx_load_flat(FILE *fp)
+{
+	uint32_t x[5], i;
+	uint64_t y[3], sum_len = 0, off;
+	int64_t st = ftell(fp) - 4, st_map;
+	const uint8_t *base;
+	const uint64_t *dir;
+	void *mm;
+	mm_idx_t *mi;
+
+	if (fread(x, 4, 5, fp) != 5) return 0;
+	if (fread(y, 8, 3, fp) != 3) return 0;
+#ifdef WIN32
+	st_map = st;
+	mm = malloc(y[0]);
+	fseek(fp, st, SEEK_SET);
+	if (fread(mm, 1, y[0], fp) != y[0]) {
+		free(mm);
+		return 0;
+	}
+#else
+	st_map = st / sysconf(_SC_PAGESIZE) * sysconf(_SC_PAGESIZE); // mmap() requires a page-aligned offset
+	mm = mmap(0, y[0] + (st - st_map), PROT_READ, MAP_SHARED, fileno(fp), st_map);
+	if (mm == MAP_FAILED) return 0;
+#endif
+	base = (const uint8_t*)mm + (st - st_map);
+	mi = mm_idx_init(x[0], x[1], x[2], x[4]);
+	mi->mm = mm, mi->mm_len = y[0] + (st - st_map);
+	mi->n_seq = x[3];
+	mi->seq = (mm_idx_seq_t*)kcalloc(mi->km, mi->n_seq, sizeof(mm_idx_seq_t));
+	for (i = 0, off = MM_IDX_FLAT_HDR; i < mi->n_seq; ++i) {
+		mm_idx_seq_t *s = &mi->seq[i];
+		uint8_t l = base[off++];
+		if (l) {
+			s->name = (char*)kmalloc(mi->km, l + 1);
+			memcpy(s->name, &base[off], l);
+			s->name[l] = 0;
+		}
+		memcpy(&s->len, &base[off + l], 4);
+		off += l + 4;
+		s->offset = sum_len;
+		sum_len += s->len;
+	}
+	dir = (const uint64_t*)(base + y[1]);
+	for (i = 0; i < 1U<<mi->b; ++i) {
+		mm_idx_bucket_t *b = &mi->B[i];
+		b->n = dir[i<<2|1];
+		b->p = (uint64_t*)(base + dir[i<<2|0]); // read-only; the index is never modified after loading
+		if (dir[i<<2|3] == 0) continue;
+		b->t = (uint64_t*)(base + dir[i<<2|2]);
+		b->t_mask = dir[i<<2|3] - 1;
+	}
+	if (!(mi->flag & MM_I_NO_SEQ))
+		mi->S = (uint32_t*)(base + y[2]);
+	if (mi->flag & MM_I_BLOOM) { // right after the last bucket or S
+		i = (1U<<mi->b) - 1;
+		off = dir[i<<2|2] + dir[i<<2|3] * 16;
+		if (!(mi->flag & MM_I_NO_SEQ))
+			off += ((sum_len + 7) / 8 * 4 + 7) & ~7ULL;
+		memcpy(&mi->n_bf, base + off, 8);
+		mi->bf = (uint64_t*)(base + off + 8);
+	}
+	fseek(fp, st + y[0], SEEK_SET);
+	return mi;
+}
+
+static mm_idx_t *idx_load(FILE *fp, int skip_seq) // with _skip_seq_, seek over the sequences, as if built with MM_I_NO_SEQ
 {
 	char magic[4];
 	uint32_t x[5], i;
@@ -469,6 +1268,7 @@ mm_idx_t *mm_idx_load(FILE *fp)
 	mm_idx_t *mi;
 
 	if (fread(magic, 1, 4, fp) != 4) return 0;
+	if (strncmp(magic, MM_IDX_MAGIC_FLAT, 4) == 0) return mm_idx_load_flat(fp);
 	if (strncmp(magic, MM_IDX_MAGIC, 4) != 0) return 0;
 	if (fread(x, 4, 5, fp) != 5) return 0;
 	mi = mm_idx_init(x[0], x[1], x[2], x[4]);
@@ -490,31 +1290,35 @@ mm_idx_t *mm_idx_load(FILE *fp)
 	for (i = 0; i < 1<<mi->b; ++i) {
 		mm_idx_bucket_t *b = &mi->B[i];
 		uint32_t j, size;
-		khint_t k;
-		idxhash_t *h;
 		fread(&b->n, 4, 1, fp);
 		b->p = (uint64_t*)malloc(b->n * 8);
 		fread(b->p, 8, b->n, fp);
 		fread(&size, 4, 1, fp);
 		if (size == 0) continue;
-		b->h = h = kh_init(idx);
-		kh_resize(idx, h, size);
+		bucket_alloc(b, size);
 		for (j = 0; j < size; ++j) {
 			uint64_t x[2];
-			int absent;
 			fread(x, 8, 2, fp);
-			k = kh_put(idx, h, x[0], &absent);
-			assert(absent);
-			kh_val(h, k) = x[1];
+			flat_put(b->t, b->t_mask, x[0], x[1]);
 		}
 	}
-	if (!(mi->flag & MM_I_NO_SEQ)) {
+	if (!(mi->flag & MM_I_NO_SEQ) && skip_seq) {
+		fseek(fp, (sum_len + 7) / 8 * 4, SEEK_CUR);
+		mi->flag |= MM_I_NO_SEQ;
+	} else if (!(mi->flag & MM_I_NO_SEQ)) {
 		mi->S = (uint32_t*)malloc((sum_len + 7) / 8 * 4);
 		fread(mi->S, 4, (sum_len + 7) / 8, fp);
 	}
 	return mi;
 }
 
+mm_idx_t *mm_idx_load(FILE *fp)
+{
+	mm_idx_t *mi = idx_load(fp, 0);
+	if (mi && (mi->flag & MM_I_BLOOM) && mi->bf == 0) mm_idx_bloom(mi, 1);
+	return mi;
+}
+
 int64_t mm_idx_is_idx(const char *fn)
 {
 	int fd, is_idx = 0;
@@ -532,7 +1336,7 @@ int64_t mm_idx_is_idx(const char *fn)
 		lseek(fd, 0, SEEK_SET);
 #endif // WIN32
 		ret = read(fd, magic, 4);
-		if (ret == 4 && strncmp(magic, MM_IDX_MAGIC, 4) == 0)
+		if (ret == 4 && (strncmp(magic, MM_IDX_MAGIC, 4) == 0 || strncmp(magic, MM_IDX_MAGIC_FLAT, 4) == 0))
 			is_idx = 1;
 	}
 	close(fd);
@@ -569,13 +1373,31 @@ mm_idx_t *mm_idx_reader_read(mm_idx_reader_t *r, int n_threads)
 {
 	mm_idx_t *mi;
 	if (r->is_idx) {
-		mi = mm_idx_load(r->fp.idx);
+		mi = idx_load(r->fp.idx, r->opt.flag & MM_I_NO_SEQ); // the mmap()ed sequences of a flat index are not read unless used
 		if (mi && mm_verbose >= 2 && (mi->k != r->opt.k || mi->w != r->opt.w || (mi->flag&MM_I_HPC) != (r->opt.flag&MM_I_HPC)))
 			fprintf(stderr, "[WARNING]\033[1;31m Indexing parameters (-k, -w or -H) overridden by parameters used in the prebuilt index.\033[0m\n");
+		if (mi && r->fn_add && mm_idx_reader_eof(r) && mm_idx_append(mi, r->fn_add, r->opt.mini_batch_size, n_threads) < 0) {
+			if (mm_verbose >= 1) fprintf(stderr, "[ERROR] failed to append sequences from '%s'\n", r->fn_add);
+			mm_idx_destroy(mi);
+			return 0;
+		}
+		if (mi && ((r->opt.flag | mi->flag) & MM_I_BLOOM) && mi->bf == 0) { // a filter is only saved in the flat format
+			if (mi->mm && mm_verbose >= 2)
+				fprintf(stderr, "[WARNING]\033[1;31m --idx-bloom has no effect on an index in the flat format built without it.\033[0m\n");
+			mm_idx_bloom(mi, n_threads);
+		}
 	} else
-		mi = mm_idx_gen(r->fp.seq, r->opt.w, r->opt.k, r->opt.bucket_bits, r->opt.flag, r->opt.mini_batch_size, n_threads, r->opt.batch_size);
+		mi = mm_idx_gen(r->fp.seq, r->opt.w, r->opt.k, r->opt.bucket_bits, r->opt.flag & ~(MM_I_FLAT|MM_I_PACK), r->opt.mini_batch_size, n_threads, r->opt.batch_size);
 	if (mi) {
-		if (r->fp_out) mm_idx_dump(r->fp_out, mi);
+		if (r->fp_out) {
+			if (r->opt.flag & MM_I_FLAT) mm_idx_dump_flat(r->fp_out, mi);
+			else mm_idx_dump(r->fp_out, mi);
+		}
+		if (r->opt.flag & MM_I_PACK) {
+			if (mi->mm && mm_verbose >= 2)
+				fprintf(stderr, "[WARNING]\033[1;31m --idx-pack has no effect on an index in the flat format.\033[0m\n");
+			mm_idx_pack(mi, n_threads);
+		}
 		mi->index = r->n_parts++;
 	}
 	return mi;
@@ -79,6 +79,39 @@ int ksw_gg(void *km, int qlen, const uint8_t *query, int tlen, const uint8_t *ta
 int ksw_gg2(void *km, int qlen, const uint8_t *query, int tlen, const uint8_t *target, int8_t m, const int8_t *mat, int8_t gapo, int8_t gape, int w, int *m_cigar_, int *n_cigar_, uint32_t **cigar_);
 int ksw_gg2_sse(void *km, int qlen, const uint8_t *query, int tlen, const uint8_t *target, int8_t m, const int8_t *mat, int8_t gapo, int8_t gape, int w, int *m_cigar_, int *n_cigar_, uint32_t **cigar_);
 
+typedef struct {
+	int qlen, tlen;        // (in) query and target lengths; both positive
+	const uint8_t *query, *target;
+	int score;             // (out) score of the global alignment
+	int m_cigar, n_cigar;
+	uint32_t *cigar;       // (out) allocated from km
+} ksw_ggb_t;
+
+/**
+ * Global alignment of many short sequence pairs, one pair per SIMD lane
+ *
+ * The recurrence and tie-breaking are the same as in ksw_extz2_sse() (if
+ * gapo==gapo2 and gape==gape2) or ksw_extd2_sse(). Results are identical to
+ * theirs when the band covers the whole matrix. Keep pairs of similar sizes
+ * adjacent in _b_: each group of 8 is computed to its largest member.
+ */
+void ksw_gg_batch_sse(void *km, int n, ksw_ggb_t *b, int8_t m, const int8_t *mat, int8_t gapo, int8_t gape, int8_t gapo2, int8_t gape2);
+
+/**
+ * Global alignment with the gap-affine wavefront algorithm
+ *
+ * The scoring is the same as in ksw_extd2_sse() (or ksw_extz2_sse() when
+ * gapo==gapo2 and gape==gape2), but the time grows with the alignment
+ * penalty instead of the matrix size. Only global alignment is supported.
+ *
+ * @param max_pen   give up once the penalty, a*(qlen+tlen)-2*score, exceeds this
+ *
+ * @return          1 if the alignment is found; 0 if it costs more than max_pen or
+ *                  a sequence contains ambiguous bases
+ */
+int ksw_wfa(void *km, int qlen, const uint8_t *query, int tlen, const uint8_t *target, int8_t m, const int8_t *mat,
+			int8_t gapo, int8_t gape, int8_t gapo2, int8_t gape2, int max_pen, int flag, ksw_extz_t *ez);
+
 void *ksw_ll_qinit(void *km, int size, int qlen, const uint8_t *query, int m, const int8_t *mat);
 int ksw_ll_i16(void *q, int tlen, const uint8_t *target, int gapo, int gape, int *qe, int *te);
 
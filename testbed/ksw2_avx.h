@@ -0,0 +1,188 @@
+#ifndef KSW2_AVX_H_
+#define KSW2_AVX_H_
+
+/*
+ * 8-bit vector primitives shared by the AVX2 and AVX-512BW builds of the ksw2
+ * extension kernels. Each ksw2_ext*2_avx.c is compiled once with -mavx2 and once
+ * with -mavx512bw; KSW_VW is the number of cells per vector.
+ *
+ * The kernels produce results identical to the SSE kernels. The SSE kernels
+ * compute each anti-diagonal over the band [st,en] rounded to 16 cells, and
+ * cells outside it keep values from earlier rows, which later rows may read.
+ * The wide kernels therefore compute whole vectors and then restore the cells
+ * outside the 16-cell band with ksw_avx_save() and ksw_avx_restore().
+ */
+
+#include <stdint.h>
+#include <immintrin.h>
+
+#if defined(__AVX512BW__)
+#define KSW_VW 64
+typedef __m512i kswv_t;
+#define kswv_load(p)          _mm512_load_si512((const void*)(p))
+#define kswv_loadu(p)         _mm512_loadu_si512((const void*)(p))
+#define kswv_store(p, a)      _mm512_store_si512((void*)(p), a)
+#define kswv_storeu(p, a)     _mm512_storeu_si512((void*)(p), a)
+#define kswv_set1(x)          _mm512_set1_epi8(x)
+#define kswv_add(a, b)        _mm512_add_epi8(a, b)
+#define kswv_sub(a, b)        _mm512_sub_epi8(a, b)
+#define kswv_max(a, b)        _mm512_max_epi8(a, b)
+#define kswv_min(a, b)        _mm512_min_epi8(a, b)
+#define kswv_maxu(a, b)       _mm512_max_epu8(a, b)
+#define kswv_minu(a, b)       _mm512_min_epu8(a, b)
+#define kswv_and(a, b)        _mm512_and_si512(a, b)
+#define kswv_andnot(a, b)     _mm512_andnot_si512(a, b)
+#define kswv_or(a, b)         _mm512_or_si512(a, b)
+#define kswv_cmpeq(a, b)      _mm512_movm_epi8(_mm512_cmpeq_epi8_mask(a, b))
+#define kswv_cmpgt(a, b)      _mm512_movm_epi8(_mm512_cmpgt_epi8_mask(a, b))
+#define kswv_blendv(a, b, m)  _mm512_mask_blend_epi8(_mm512_movepi8_mask(m), a, b)
+#define kswv_last(x)          _mm512_maskz_set1_epi8(1ULL<<63, x)                        // x at the last byte; zero elsewhere
+#define kswv_shl1(a, prev)    _mm512_alignr_epi8(a, _mm512_alignr_epi64(a, prev, 6), 15) // prev[VW-1], a[0..VW-2]
+#elif defined(__AVX2__)
+#define KSW_VW 32
+typedef __m256i kswv_t;
+#define kswv_load(p)          _mm256_load_si256((const __m256i*)(p))
+#define kswv_loadu(p)         _mm256_loadu_si256((const __m256i*)(p))
+#define kswv_store(p, a)      _mm256_store_si256((__m256i*)(p), a)
+#define kswv_storeu(p, a)     _mm256_storeu_si256((__m256i*)(p), a)
+#define kswv_set1(x)          _mm256_set1_epi8(x)
+#define kswv_add(a, b)        _mm256_add_epi8(a, b)
+#define kswv_sub(a, b)        _mm256_sub_epi8(a, b)
+#define kswv_max(a, b)        _mm256_max_epi8(a, b)
+#define kswv_min(a, b)        _mm256_min_epi8(a, b)
+#define kswv_maxu(a, b)       _mm256_max_epu8(a, b)
+#define kswv_minu(a, b)       _mm256_min_epu8(a, b)
+#define kswv_and(a, b)        _mm256_and_si256(a, b)
+#define kswv_andnot(a, b)     _mm256_andnot_si256(a, b)
+#define kswv_or(a, b)         _mm256_or_si256(a, b)
+#define kswv_cmpeq(a, b)      _mm256_cmpeq_epi8(a, b)
+#define kswv_cmpgt(a, b)      _mm256_cmpgt_epi8(a, b)
+#define kswv_blendv(a, b, m)  _mm256_blendv_epi8(a, b, m)
+#define kswv_last(x)          _mm256_insert_epi8(_mm256_setzero_si256(), x, 31)
+#define kswv_shl1(a, prev)    _mm256_alignr_epi8(a, _mm256_permute2x128_si256(prev, a, 0x21), 15)
+#endif
+
+static const int8_t ksw_avx_idx[64] = {
+	 0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15,
+	16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31,
+	32, 33, 34, 35, 36, 37, 38, 39, 40, 41, 42, 43, 44, 45, 46, 47,
+	48, 49, 50, 51, 52, 53, 54, 55, 56, 57, 58, 59, 60, 61, 62, 63
+};
+
+// set s[st0..en0] with the same 16-byte stores as the SSE kernels; bytes written past en0 are read by later rows
+static inline void ksw_avx_set_sc(int st0, int en0, const uint8_t *sf, const uint8_t *qrr, int8_t *s, int8_t mch, int8_t mis, int8_t sc_N, int8_t m1)
+{
+	kswv_t sc_mch_ = kswv_set1(mch), sc_mis_ = kswv_set1(mis), sc_N_ = kswv_set1(sc_N), m1_ = kswv_set1(m1);
+	__m128i sc_mch = _mm_set1_epi8(mch), sc_mis = _mm_set1_epi8(mis), sc_n = _mm_set1_epi8(sc_N), m1x = _mm_set1_epi8(m1);
+	int t;
+	for (t = st0; t + KSW_VW - 16 <= en0; t += KSW_VW) {
+		kswv_t sq, st, tmp, mask;
+		sq = kswv_loadu(&sf[t]);
+		st = kswv_loadu(&qrr[t]);
+		mask = kswv_or(kswv_cmpeq(sq, m1_), kswv_cmpeq(st, m1_));
+		tmp = kswv_cmpeq(sq, st);
+		tmp = kswv_blendv(sc_mis_, sc_mch_, tmp);
+		tmp = kswv_blendv(tmp,     sc_N_,   mask);
+		kswv_storeu(&s[t], tmp);
+	}
+	for (; t <= en0; t += 16) {
+		__m128i sq, st, tmp, mask;
+		sq = _mm_loadu_si128((const __m128i*)&sf[t]);
+		st = _mm_loadu_si128((const __m128i*)&qrr[t]);
+		mask = _mm_or_si128(_mm_cmpeq_epi8(sq, m1x), _mm_cmpeq_epi8(st, m1x));
+		tmp = _mm_cmpeq_epi8(sq, st);
+		tmp = _mm_blendv_epi8(sc_mis, sc_mch, tmp);
+		tmp = _mm_blendv_epi8(tmp,    sc_n,   mask);
+		_mm_storeu_si128((__m128i*)&s[t], tmp);
+	}
+}
+
+// save vectors st_ and en_ of the _n_ arrays a[0], a[tlen_], a[2*tlen_], ...
+static inline void ksw_avx_save(const kswv_t *a, int tlen_, int n, int st_, int en_, int st, int en, kswv_t *sv)
+{
+	int i;
+	if (st == st_ * KSW_VW && en == en_ * KSW_VW + KSW_VW - 1) return; // the band is vector aligned
+	for (i = 0; i < n; ++i)
+		sv[i<<1] = kswv_load(&a[i * tlen_ + st_]), sv[i<<1|1] = kswv_load(&a[i * tlen_ + en_]);
+}
+
+// put back cells before _st_ and after _en_ from the vectors saved by ksw_avx_save()
+static inline void ksw_avx_restore(kswv_t *a, int tlen_, int n, int st_, int en_, int st, int en, const kswv_t *sv)
+{
+	kswv_t idx, keep_st, keep_en;
+	int i;
+	if (st == st_ * KSW_VW && en == en_ * KSW_VW + KSW_VW - 1) return;
+	idx = kswv_loadu(ksw_avx_idx);
+	keep_st = kswv_cmpgt(kswv_set1(st - st_ * KSW_VW), idx);
+	keep_en = kswv_cmpgt(idx, kswv_set1(en - en_ * KSW_VW));
+	if (st_ == en_) keep_st = keep_en = kswv_or(keep_st, keep_en);
+	for (i = 0; i < n; ++i) {
+		kswv_t *p = &a[i * tlen_ + st_], *q = &a[i * tlen_ + en_];
+		kswv_store(p, kswv_blendv(kswv_load(p), sv[i<<1], keep_st));
+		kswv_store(q, kswv_blendv(kswv_load(q), sv[i<<1|1], keep_en));
+	}
+}
+
+// H[t] += v[t] + d for t in [st0,en1) and update the max, where en1 = st0+(en0-st0)/4*4; ties are broken as in the 4-lane SSE loop
+static inline void ksw_avx_update_H(int32_t *H, const void *v, int is_u8, int32_t d, int st0, int en0, int32_t *max_H_, int32_t *max_t_)
+{
+	int32_t HH[KSW_VW/4], tt[KSW_VW/4], max_H = *max_H_, max_t = *max_t_;
+	int t, i, j, en1 = st0 + (en0 - st0) / 4 * 4, enw = st0 + (en0 - st0) / (KSW_VW/4) * (KSW_VW/4);
+	const uint8_t *vu = (const uint8_t*)v;
+	const int8_t *vi = (const int8_t*)v;
+	__m128i mH, mt, d4 = _mm_set1_epi32(d);
+#if defined(__AVX512BW__)
+	__m512i wH = _mm512_set1_epi32(max_H), wt = _mm512_set1_epi32(max_t), wd = _mm512_set1_epi32(d);
+	__m512i wo = _mm512_setr_epi32(0, 0, 0, 0, 4, 4, 4, 4, 8, 8, 8, 8, 12, 12, 12, 12);
+	for (t = st0; t < enw; t += 16) {
+		__m128i v16 = _mm_loadu_si128((const __m128i*)&vu[t]);
+		__m512i H1 = _mm512_loadu_si512((const void*)&H[t]);
+		__mmask16 m;
+		H1 = _mm512_add_epi32(H1, _mm512_add_epi32(is_u8? _mm512_cvtepu8_epi32(v16) : _mm512_cvtepi8_epi32(v16), wd));
+		_mm512_storeu_si512((void*)&H[t], H1);
+		m = _mm512_cmpgt_epi32_mask(H1, wH);
+		wH = _mm512_mask_blend_epi32(m, wH, H1);
+		wt = _mm512_mask_blend_epi32(m, wt, _mm512_add_epi32(_mm512_set1_epi32(t), wo));
+	}
+	_mm512_storeu_si512((void*)HH, wH);
+	_mm512_storeu_si512((void*)tt, wt);
+#else
+	__m256i wH = _mm256_set1_epi32(max_H), wt = _mm256_set1_epi32(max_t), wd = _mm256_set1_epi32(d);
+	__m256i wo = _mm256_setr_epi32(0, 0, 0, 0, 4, 4, 4, 4);
+	for (t = st0; t < enw; t += 8) {
+		__m128i v8 = _mm_loadl_epi64((const __m128i*)&vu[t]);
+		__m256i H1 = _mm256_loadu_si256((const __m256i*)&H[t]), tmp;
+		H1 = _mm256_add_epi32(H1, _mm256_add_epi32(is_u8? _mm256_cvtepu8_epi32(v8) : _mm256_cvtepi8_epi32(v8), wd));
+		_mm256_storeu_si256((__m256i*)&H[t], H1);
+		tmp = _mm256_cmpgt_epi32(H1, wH);
+		wH = _mm256_blendv_epi8(wH, H1, tmp);
+		wt = _mm256_blendv_epi8(wt, _mm256_add_epi32(_mm256_set1_epi32(t), wo), tmp);
+	}
+	_mm256_storeu_si256((__m256i*)HH, wH);
+	_mm256_storeu_si256((__m256i*)tt, wt);
+#endif
+	for (i = 0; i < 4; ++i) // fold into the four lanes of the SSE loop: the larger score wins, then the smaller t
+		for (j = i + 4; j < KSW_VW/4; j += 4)
+			if (HH[j] > HH[i] || (HH[j] == HH[i] && tt[j] < tt[i]))
+				HH[i] = HH[j], tt[i] = tt[j];
+	mH = _mm_loadu_si128((const __m128i*)HH);
+	mt = _mm_loadu_si128((const __m128i*)tt);
+	for (t = enw; t < en1; t += 4) {
+		__m128i H1, tmp, t_;
+		H1 = _mm_loadu_si128((__m128i*)&H[t]);
+		t_ = is_u8? _mm_setr_epi32(vu[t], vu[t+1], vu[t+2], vu[t+3]) : _mm_setr_epi32(vi[t], vi[t+1], vi[t+2], vi[t+3]);
+		H1 = _mm_add_epi32(_mm_add_epi32(H1, t_), d4);
+		_mm_storeu_si128((__m128i*)&H[t], H1);
+		t_ = _mm_set1_epi32(t);
+		tmp = _mm_cmpgt_epi32(H1, mH);
+		mH = _mm_blendv_epi8(mH, H1, tmp);
+		mt = _mm_blendv_epi8(mt, t_, tmp);
+	}
+	_mm_storeu_si128((__m128i*)HH, mH);
+	_mm_storeu_si128((__m128i*)tt, mt);
+	for (i = 0; i < 4; ++i)
+		if (max_H < HH[i]) max_H = HH[i], max_t = tt[i] + i;
+	*max_H_ = max_H, *max_t_ = max_t;
+}
+
+#endif
@@ -1,5 +1,6 @@
 #ifdef KSW_CPU_DISPATCH
 #include <stdlib.h>
+#include <stdint.h>
 #include "ksw2.h"
 
 #define SIMD_SSE     0x1
@@ -11,6 +12,7 @@
 #define SIMD_AVX     0x40
 #define SIMD_AVX2    0x80
 #define SIMD_AVX512F 0x100
+#define SIMD_AVX512BW 0x200
 
 #ifndef _MSC_VER
 // adapted from https://github.com/01org/linux-sgx/blob/master/common/inc/internal/linux/cpuid_gnu.h
@@ -26,11 +28,22 @@ void __cpuidex(int cpuid[4], int func_id, int subfunc_id)
 			: "0" (func_id), "2" (subfunc_id));
 #endif
 }
+
+static uint64_t xgetbv0(void) // the XCR0 register; which vector states the OS saves on context switches
+{
+	uint32_t eax, edx;
+	asm volatile ("xgetbv" : "=a" (eax), "=d" (edx) : "c" (0));
+	return (uint64_t)edx<<32 | eax;
+}
+#else
+#define xgetbv0() _xgetbv(0)
 #endif
 
 int x86_simd(void)
 {
-	int flag = 0, cpuid[4], max_id;
+	static int simd_flag = -1;
+	int flag = 0, cpuid[4], max_id, os_avx = 0, os_avx512 = 0;
+	if (simd_flag >= 0) return simd_flag;
 	__cpuidex(cpuid, 0, 0);
 	max_id = cpuid[0];
 	if (max_id == 0) return 0;
@@ -42,21 +55,33 @@ int x86_simd(void)
 	if (cpuid[2]>>19&1) flag |= SIMD_SSE4_1;
 	if (cpuid[2]>>20&1) flag |= SIMD_SSE4_2;
 	if (cpuid[2]>>28&1) flag |= SIMD_AVX;
+	if (cpuid[2]>>27&1) { // OSXSAVE
+		uint64_t xcr0 = xgetbv0();
+		os_avx = ((xcr0 & 0x6) == 0x6);
+		os_avx512 = os_avx && ((xcr0 & 0xe0) == 0xe0);
+	}
 	if (max_id >= 7) {
 		__cpuidex(cpuid, 7, 0);
-		if (cpuid[1]>>5 &1) flag |= SIMD_AVX2;
-		if (cpuid[1]>>16&1) flag |= SIMD_AVX512F;
+		if (os_avx && cpuid[1]>>5 &1) flag |= SIMD_AVX2;
+		if (os_avx512 && cpuid[1]>>16&1) flag |= SIMD_AVX512F;
+		if (os_avx512 && cpuid[1]>>30&1) flag |= SIMD_AVX512BW;
 	}
-	return flag;
+	return simd_flag = flag;
 }
 
 void ksw_extz2_sse(void *km, int qlen, const uint8_t *query, int tlen, const uint8_t *target, int8_t m, const int8_t *mat, int8_t q, int8_t e, int w, int zdrop, int end_bonus, int flag, ksw_extz_t *ez)
 {
 	extern void ksw_extz2_sse2(void *km, int qlen, const uint8_t *query, int tlen, const uint8_t *target, int8_t m, const int8_t *mat, int8_t q, int8_t e, int w, int zdrop, int end_bonus, int flag, ksw_extz_t *ez);
 	extern void ksw_extz2_sse41(void *km, int qlen, const uint8_t *query, int tlen, const uint8_t *target, int8_t m, const int8_t *mat, int8_t q, int8_t e, int w, int zdrop, int end_bonus, int flag, ksw_extz_t *ez);
+	extern void ksw_extz2_avx2(void *km, int qlen, const uint8_t *query, int tlen, const uint8_t *target, int8_t m, const int8_t *mat, int8_t q, int8_t e, int w, int zdrop, int end_bonus, int flag, ksw_extz_t *ez);
+	extern void ksw_extz2_avx512(void *km, int qlen, const uint8_t *query, int tlen, const uint8_t *target, int8_t m, const int8_t *mat, int8_t q, int8_t e, int w, int zdrop, int end_bonus, int flag, ksw_extz_t *ez);
 	unsigned simd;
 	simd = x86_simd();
-	if (simd & SIMD_SSE4_1)
+	if (simd & SIMD_AVX512BW)
+		ksw_extz2_avx512(km, qlen, query, tlen, target, m, mat, q, e, w, zdrop, end_bonus, flag, ez);
+	else if (simd & SIMD_AVX2)
+		ksw_extz2_avx2(km, qlen, query, tlen, target, m, mat, q, e, w, zdrop, end_bonus, flag, ez);
+	else if (simd & SIMD_SSE4_1)
 		ksw_extz2_sse41(km, qlen, query, tlen, target, m, mat, q, e, w, zdrop, end_bonus, flag, ez);
 	else if (simd & SIMD_SSE2)
 		ksw_extz2_sse2(km, qlen, query, tlen, target, m, mat, q, e, w, zdrop, end_bonus, flag, ez);
@@ -70,9 +95,17 @@ void ksw_extd2_sse(void *km, int qlen, const uint8_t *query, int tlen, const uin
 				   int8_t q, int8_t e, int8_t q2, int8_t e2, int w, int zdrop, int end_bonus, int flag, ksw_extz_t *ez);
 	extern void ksw_extd2_sse41(void *km, int qlen, const uint8_t *query, int tlen, const uint8_t *target, int8_t m, const int8_t *mat,
 				   int8_t q, int8_t e, int8_t q2, int8_t e2, int w, int zdrop, int end_bonus, int flag, ksw_extz_t *ez);
+	extern void ksw_extd2_avx2(void *km, int qlen, const uint8_t *query, int tlen, const uint8_t *target, int8_t m, const int8_t *mat,
+				   int8_t q, int8_t e, int8_t q2, int8_t e2, int w, int zdrop, int end_bonus, int flag, ksw_extz_t *ez);
+	extern void ksw_extd2_avx512(void *km, int qlen, const uint8_t *query, int tlen, const uint8_t *target, int8_t m, const int8_t *mat,
+				   int8_t q, int8_t e, int8_t q2, int8_t e2, int w, int zdrop, int end_bonus, int flag, ksw_extz_t *ez);
 	unsigned simd;
 	simd = x86_simd();
-	if (simd & SIMD_SSE4_1)
+	if (simd & SIMD_AVX512BW)
+		ksw_extd2_avx512(km, qlen, query, tlen, target, m, mat, q, e, q2, e2, w, zdrop, end_bonus, flag, ez);
+	else if (simd & SIMD_AVX2)
+		ksw_extd2_avx2(km, qlen, query, tlen, target, m, mat, q, e, q2, e2, w, zdrop, end_bonus, flag, ez);
+	else if (simd & SIMD_SSE4_1)
 		ksw_extd2_sse41(km, qlen, query, tlen, target, m, mat, q, e, q2, e2, w, zdrop, end_bonus, flag, ez);
 	else if (simd & SIMD_SSE2)
 		ksw_extd2_sse2(km, qlen, query, tlen, target, m, mat, q, e, q2, e2, w, zdrop, end_bonus, flag, ez);
@@ -86,9 +119,17 @@ void ksw_exts2_sse(void *km, int qlen, const uint8_t *query, int tlen, const uin
 				   int8_t q, int8_t e, int8_t q2, int8_t noncan, int zdrop, int flag, ksw_extz_t *ez);
 	extern void ksw_exts2_sse41(void *km, int qlen, const uint8_t *query, int tlen, const uint8_t *target, int8_t m, const int8_t *mat,
 				   int8_t q, int8_t e, int8_t q2, int8_t noncan, int zdrop, int flag, ksw_extz_t *ez);
+	extern void ksw_exts2_avx2(void *km, int qlen, const uint8_t *query, int tlen, const uint8_t *target, int8_t m, const int8_t *mat,
+				   int8_t q, int8_t e, int8_t q2, int8_t noncan, int zdrop, int flag, ksw_extz_t *ez);
+	extern void ksw_exts2_avx512(void *km, int qlen, const uint8_t *query, int tlen, const uint8_t *target, int8_t m, const int8_t *mat,
+				   int8_t q, int8_t e, int8_t q2, int8_t noncan, int zdrop, int flag, ksw_extz_t *ez);
 	unsigned simd;
 	simd = x86_simd();
-	if (simd & SIMD_SSE4_1)
+	if (simd & SIMD_AVX512BW)
+		ksw_exts2_avx512(km, qlen, query, tlen, target, m, mat, q, e, q2, noncan, zdrop, flag, ez);
+	else if (simd & SIMD_AVX2)
+		ksw_exts2_avx2(km, qlen, query, tlen, target, m, mat, q, e, q2, noncan, zdrop, flag, ez);
+	else if (simd & SIMD_SSE4_1)
 		ksw_exts2_sse41(km, qlen, query, tlen, target, m, mat, q, e, q2, noncan, zdrop, flag, ez);
 	else if (simd & SIMD_SSE2)
 		ksw_exts2_sse2(km, qlen, query, tlen, target, m, mat, q, e, q2, noncan, zdrop, flag, ez);
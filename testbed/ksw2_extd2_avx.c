@@ -0,0 +1,287 @@
+#include <string.h>
+#include <assert.h>
+#include "ksw2.h"
+
+#ifdef __AVX2__
+#include "ksw2_avx.h"
+
+#ifdef __AVX512BW__
+void ksw_extd2_avx512(void *km, int qlen, const uint8_t *query, int tlen, const uint8_t *target, int8_t m, const int8_t *mat,
+					  int8_t q, int8_t e, int8_t q2, int8_t e2, int w, int zdrop, int end_bonus, int flag, ksw_extz_t *ez)
+#else
+void ksw_extd2_avx2(void *km, int qlen, const uint8_t *query, int tlen, const uint8_t *target, int8_t m, const int8_t *mat,
+					int8_t q, int8_t e, int8_t q2, int8_t e2, int w, int zdrop, int end_bonus, int flag, ksw_extz_t *ez)
+#endif
+{
+#define __dp_code_block1 \
+	z = kswv_load(&s[t]); \
+	xt1 = kswv_load(&x[t]);                          /* xt1 <- x[r-1][t..t+VW-1] */ \
+	tmp = xt1; \
+	xt1 = kswv_shl1(xt1, x1_);                       /* xt1 <- x[r-1][t-1..t+VW-2] */ \
+	x1_ = tmp; \
+	vt1 = kswv_load(&v[t]);                          /* vt1 <- v[r-1][t..t+VW-1] */ \
+	tmp = vt1; \
+	vt1 = kswv_shl1(vt1, v1_);                       /* vt1 <- v[r-1][t-1..t+VW-2] */ \
+	v1_ = tmp; \
+	a = kswv_add(xt1, vt1);                          /* a <- x[r-1][t-1..t+VW-2] + v[r-1][t-1..t+VW-2] */ \
+	ut = kswv_load(&u[t]);                           /* ut <- u[t..t+VW-1] */ \
+	b = kswv_add(kswv_load(&y[t]), ut);              /* b <- y[r-1][t..t+VW-1] + u[r-1][t..t+VW-1] */ \
+	x2t1= kswv_load(&x2[t]); \
+	tmp = x2t1; \
+	x2t1= kswv_shl1(x2t1, x21_); \
+	x21_= tmp; \
+	a2= kswv_add(x2t1, vt1); \
+	b2= kswv_add(kswv_load(&y2[t]), ut);
+
+#define __dp_code_block2 \
+	kswv_store(&u[t], kswv_sub(z, vt1));             /* u[r][t..t+VW-1] <- z - v[r-1][t-1..t+VW-2] */ \
+	kswv_store(&v[t], kswv_sub(z, ut));              /* v[r][t..t+VW-1] <- z - u[r-1][t..t+VW-1] */ \
+	tmp = kswv_sub(z, q_); \
+	a = kswv_sub(a, tmp); \
+	b = kswv_sub(b, tmp); \
+	tmp = kswv_sub(z, q2_); \
+	a2= kswv_sub(a2, tmp); \
+	b2= kswv_sub(b2, tmp);
+
+	int r, t, qe = q + e, n_col_, n_colb, *off = 0, *off_end = 0, tlen_, qlen_, last_st, last_en, wl, wr, max_sc, min_sc, long_thres, long_diff;
+	int with_cigar = !(flag&KSW_EZ_SCORE_ONLY), approx_max = !!(flag&KSW_EZ_APPROX_MAX);
+	int32_t *H = 0, H0 = 0, last_H0_t = 0;
+	uint8_t *qr, *sf, *mem, *mem2 = 0, *p = 0;
+	kswv_t q_, q2_, qe_, qe2_, zero_, sc_mch_;
+	kswv_t *u, *v, *x, *y, *x2, *y2, *s;
+
+	ksw_reset_extz(ez);
+	if (m <= 1 || qlen <= 0 || tlen <= 0) return;
+
+	if (q2 + e2 < q + e) t = q, q = q2, q2 = t, t = e, e = e2, e2 = t; // make sure q+e no larger than q2+e2
+
+	zero_   = kswv_set1(0);
+	q_      = kswv_set1(q);
+	q2_     = kswv_set1(q2);
+	qe_     = kswv_set1(q + e);
+	qe2_    = kswv_set1(q2 + e2);
+	sc_mch_ = kswv_set1(mat[0]);
+
+	if (w < 0) w = tlen > qlen? tlen : qlen;
+	wl = wr = w;
+	tlen_ = (tlen + KSW_VW - 1) / KSW_VW;
+	n_col_ = qlen < tlen? qlen : tlen;
+	n_col_ = ((n_col_ < w + 1? n_col_ : w + 1) + 15) / 16 + 1; // in 16-cell blocks, as in the SSE kernel
+	n_colb = n_col_ * 16 + KSW_VW; // bytes per row of p[]; the extra bytes take the stores outside [st,en]
+	qlen_ = (qlen + KSW_VW - 1) / KSW_VW;
+	for (t = 1, max_sc = mat[0], min_sc = mat[1]; t < m * m; ++t) {
+		max_sc = max_sc > mat[t]? max_sc : mat[t];
+		min_sc = min_sc < mat[t]? min_sc : mat[t];
+	}
+	if (-min_sc > 2 * (q + e)) return; // otherwise, we won't see any mismatches
+
+	long_thres = e != e2? (q2 - q) / (e - e2) - 1 : 0;
+	if (q2 + e2 + long_thres * e2 > q + e + long_thres * e)
+		++long_thres;
+	long_diff = long_thres * (e - e2) - (q2 - q) - e2;
+
+	mem = (uint8_t*)kcalloc(km, tlen_ * 8 + qlen_ + 2, KSW_VW);
+	u = (kswv_t*)(((size_t)mem + KSW_VW - 1) / KSW_VW * KSW_VW); // aligned to the vector size
+	v = u + tlen_, x = v + tlen_, y = x + tlen_, x2 = y + tlen_, y2 = x2 + tlen_;
+	s = y2 + tlen_, sf = (uint8_t*)(s + tlen_), qr = sf + tlen_ * KSW_VW;
+	memset(u,  -q  - e,  tlen_ * KSW_VW);
+	memset(v,  -q  - e,  tlen_ * KSW_VW);
+	memset(x,  -q  - e,  tlen_ * KSW_VW);
+	memset(y,  -q  - e,  tlen_ * KSW_VW);
+	memset(x2, -q2 - e2, tlen_ * KSW_VW);
+	memset(y2, -q2 - e2, tlen_ * KSW_VW);
+	if (!approx_max) {
+		H = (int32_t*)kmalloc(km, tlen_ * KSW_VW * 4);
+		for (t = 0; t < tlen_ * KSW_VW; ++t) H[t] = KSW_NEG_INF;
+	}
+	if (with_cigar) {
+		mem2 = (uint8_t*)kmalloc(km, (size_t)(qlen + tlen - 1) * n_colb + KSW_VW);
+		p = mem2 + KSW_VW;
+		off = (int*)kmalloc(km, (qlen + tlen - 1) * sizeof(int) * 2);
+		off_end = off + qlen + tlen - 1;
+	}
+
+	for (t = 0; t < qlen; ++t) qr[t] = query[qlen - 1 - t];
+	memcpy(sf, target, tlen);
+
+	for (r = 0, last_st = last_en = -1; r < qlen + tlen - 1; ++r) {
+		int st = 0, en = tlen - 1, st0, en0, st_, en_;
+		int8_t x1, x21, v1;
+		uint8_t *qrr = qr + (qlen - 1 - r);
+		int8_t *u8 = (int8_t*)u, *v8 = (int8_t*)v, *x8 = (int8_t*)x, *x28 = (int8_t*)x2;
+		kswv_t x1_, x21_, v1_, sv[12];
+		// find the boundaries
+		if (st < r - qlen + 1) st = r - qlen + 1;
+		if (en > r) en = r;
+		if (st < (r-wr+1)>>1) st = (r-wr+1)>>1; // take the ceil
+		if (en > (r+wl)>>1) en = (r+wl)>>1; // take the floor
+		if (st > en) {
+			ez->zdropped = 1;
+			break;
+		}
+		st0 = st, en0 = en;
+		st = st / 16 * 16, en = (en + 16) / 16 * 16 - 1;
+		// set boundary conditions
+		if (st > 0) {
+			if (st - 1 >= last_st && st - 1 <= last_en) {
+				x1 = x8[st - 1], x21 = x28[st - 1], v1 = v8[st - 1]; // (r-1,s-1) calculated in the last round
+			} else {
+				x1 = -q - e, x21 = -q2 - e2;
+				v1 = -q - e;
+			}
+		} else {
+			x1 = -q - e, x21 = -q2 - e2;
+			v1 = r == 0? -q - e : r < long_thres? -e : r == long_thres? long_diff : -e2;
+		}
+		if (en >= r) {
+			((int8_t*)y)[r] = -q - e, ((int8_t*)y2)[r] = -q2 - e2;
+			u8[r] = r == 0? -q - e : r < long_thres? -e : r == long_thres? long_diff : -e2;
+		}
+		// loop fission: set scores first
+		if (!(flag & KSW_EZ_GENERIC_SC)) {
+			ksw_avx_set_sc(st0, en0, sf, qrr, (int8_t*)s, mat[0], mat[1], mat[m*m-1] == 0? -e2 : mat[m*m-1], m - 1);
+		} else {
+			for (t = st0; t <= en0; ++t)
+				((uint8_t*)s)[t] = mat[sf[t] * m + qrr[t]];
+		}
+		// core loop over whole vectors; cells outside [st,en] are put back afterwards
+		st_ = st / KSW_VW, en_ = en / KSW_VW;
+		assert(en / 16 - st / 16 + 1 <= n_col_);
+		ksw_avx_save(u, tlen_, 6, st_, en_, st, en, sv);
+		if (st > st_ * KSW_VW) x8[st - 1] = x1, x28[st - 1] = x21, v8[st - 1] = v1; // (r-1,st-1) is read from memory
+		x1_  = kswv_last(x1);
+		x21_ = kswv_last(x21);
+		v1_  = kswv_last(v1);
+		if (!with_cigar) { // score only
+			for (t = st_; t <= en_; ++t) {
+				kswv_t z, a, b, a2, b2, xt1, x2t1, vt1, ut, tmp;
+				__dp_code_block1;
+				z = kswv_max(z, a);
+				z = kswv_max(z, b);
+				z = kswv_max(z, a2);
+				z = kswv_max(z, b2);
+				z = kswv_min(z, sc_mch_);
+				__dp_code_block2; // save u[] and v[]; update a, b, a2 and b2
+				kswv_store(&x[t],  kswv_sub(kswv_max(a,  zero_), qe_));
+				kswv_store(&y[t],  kswv_sub(kswv_max(b,  zero_), qe_));
+				kswv_store(&x2[t], kswv_sub(kswv_max(a2, zero_), qe2_));
+				kswv_store(&y2[t], kswv_sub(kswv_max(b2, zero_), qe2_));
+			}
+		} else if (!(flag&KSW_EZ_RIGHT)) { // gap left-alignment
+			uint8_t *pr = p + (size_t)r * n_colb - st;
+			off[r] = st, off_end[r] = en;
+			for (t = st_; t <= en_; ++t) {
+				kswv_t d, z, a, b, a2, b2, xt1, x2t1, vt1, ut, tmp;
+				__dp_code_block1;
+				d = kswv_and(kswv_cmpgt(a, z), kswv_set1(1));              // d = a  > z? 1 : 0
+				z = kswv_max(z, a);
+				d = kswv_blendv(d, kswv_set1(2), kswv_cmpgt(b,  z));       // d = b  > z? 2 : d
+				z = kswv_max(z, b);
+				d = kswv_blendv(d, kswv_set1(3), kswv_cmpgt(a2, z));       // d = a2 > z? 3 : d
+				z = kswv_max(z, a2);
+				d = kswv_blendv(d, kswv_set1(4), kswv_cmpgt(b2, z));       // d = b2 > z? 4 : d
+				z = kswv_max(z, b2);
+				z = kswv_min(z, sc_mch_);
+				__dp_code_block2;
+				tmp = kswv_cmpgt(a, zero_);
+				kswv_store(&x[t],  kswv_sub(kswv_and(tmp, a),  qe_));
+				d = kswv_or(d, kswv_and(tmp, kswv_set1(0x08))); // d = a > 0? 1<<3 : 0
+				tmp = kswv_cmpgt(b, zero_);
+				kswv_store(&y[t],  kswv_sub(kswv_and(tmp, b),  qe_));
+				d = kswv_or(d, kswv_and(tmp, kswv_set1(0x10))); // d = b > 0? 1<<4 : 0
+				tmp = kswv_cmpgt(a2, zero_);
+				kswv_store(&x2[t], kswv_sub(kswv_and(tmp, a2), qe2_));
+				d = kswv_or(d, kswv_and(tmp, kswv_set1(0x20))); // d = a > 0? 1<<5 : 0
+				tmp = kswv_cmpgt(b2, zero_);
+				kswv_store(&y2[t], kswv_sub(kswv_and(tmp, b2), qe2_));
+				d = kswv_or(d, kswv_and(tmp, kswv_set1(0x40))); // d = b > 0? 1<<6 : 0
+				kswv_storeu(&pr[t * KSW_VW], d);
+			}
+		} else { // gap right-alignment
+			uint8_t *pr = p + (size_t)r * n_colb - st;
+			off[r] = st, off_end[r] = en;
+			for (t = st_; t <= en_; ++t) {
+				kswv_t d, z, a, b, a2, b2, xt1, x2t1, vt1, ut, tmp;
+				__dp_code_block1;
+				d = kswv_andnot(kswv_cmpgt(z, a), kswv_set1(1));           // d = z > a?  0 : 1
+				z = kswv_max(z, a);
+				d = kswv_blendv(kswv_set1(2), d, kswv_cmpgt(z, b));        // d = z > b?  d : 2
+				z = kswv_max(z, b);
+				d = kswv_blendv(kswv_set1(3), d, kswv_cmpgt(z, a2));       // d = z > a2? d : 3
+				z = kswv_max(z, a2);
+				d = kswv_blendv(kswv_set1(4), d, kswv_cmpgt(z, b2));       // d = z > b2? d : 4
+				z = kswv_max(z, b2);
+				z = kswv_min(z, sc_mch_);
+				__dp_code_block2;
+				tmp = kswv_cmpgt(zero_, a);
+				kswv_store(&x[t],  kswv_sub(kswv_andnot(tmp, a),  qe_));
+				d = kswv_or(d, kswv_andnot(tmp, kswv_set1(0x08))); // d = a > 0? 1<<3 : 0
+				tmp = kswv_cmpgt(zero_, b);
+				kswv_store(&y[t],  kswv_sub(kswv_andnot(tmp, b),  qe_));
+				d = kswv_or(d, kswv_andnot(tmp, kswv_set1(0x10))); // d = b > 0? 1<<4 : 0
+				tmp = kswv_cmpgt(zero_, a2);
+				kswv_store(&x2[t], kswv_sub(kswv_andnot(tmp, a2), qe2_));
+				d = kswv_or(d, kswv_andnot(tmp, kswv_set1(0x20))); // d = a > 0? 1<<5 : 0
+				tmp = kswv_cmpgt(zero_, b2);
+				kswv_store(&y2[t], kswv_sub(kswv_andnot(tmp, b2), qe2_));
+				d = kswv_or(d, kswv_andnot(tmp, kswv_set1(0x40))); // d = b > 0? 1<<6 : 0
+				kswv_storeu(&pr[t * KSW_VW], d);
+			}
+		}
+		ksw_avx_restore(u, tlen_, 6, st_, en_, st, en, sv);
+		if (!approx_max) { // find the exact max with a 32-bit score array
+			int32_t max_H, max_t;
+			// compute H[], max_H and max_t
+			if (r > 0) {
+				max_H = H[en0] = en0 > 0? H[en0-1] + u8[en0] : H[en0] + v8[en0]; // special casing the last element
+				max_t = en0;
+				ksw_avx_update_H(H, v8, 0, 0, st0, en0, &max_H, &max_t); // H[t]+=v8[t]; if(H[t]>max_H) max_H=H[t],max_t=t;
+				for (t = st0 + (en0 - st0) / 4 * 4; t < en0; ++t) { // for the rest of values that haven't been computed with SIMD
+					H[t] += (int32_t)v8[t];
+					if (H[t] > max_H)
+						max_H = H[t], max_t = t;
+				}
+			} else H[0] = v8[0] - qe, max_H = H[0], max_t = 0; // special casing r==0
+			// update ez
+			if (en0 == tlen - 1 && H[en0] > ez->mte)
+				ez->mte = H[en0], ez->mte_q = r - en;
+			if (r - st0 == qlen - 1 && H[st0] > ez->mqe)
+				ez->mqe = H[st0], ez->mqe_t = st0;
+			if (ksw_apply_zdrop(ez, 1, max_H, r, max_t, zdrop, e2)) break;
+			if (r == qlen + tlen - 2 && en0 == tlen - 1)
+				ez->score = H[tlen - 1];
+		} else { // find approximate max; Z-drop might be inaccurate, too.
+			if (r > 0) {
+				if (last_H0_t >= st0 && last_H0_t <= en0 && last_H0_t + 1 >= st0 && last_H0_t + 1 <= en0) {
+					int32_t d0 = v8[last_H0_t];
+					int32_t d1 = u8[last_H0_t + 1];
+					if (d0 > d1) H0 += d0;
+					else H0 += d1, ++last_H0_t;
+				} else if (last_H0_t >= st0 && last_H0_t <= en0) {
+					H0 += v8[last_H0_t];
+				} else {
+					++last_H0_t, H0 += u8[last_H0_t];
+				}
+			} else H0 = v8[0] - qe, last_H0_t = 0;
+			if ((flag & KSW_EZ_APPROX_DROP) && ksw_apply_zdrop(ez, 1, H0, r, last_H0_t, zdrop, e2)) break;
+			if (r == qlen + tlen - 2 && en0 == tlen - 1)
+				ez->score = H0;
+		}
+		last_st = st, last_en = en;
+	}
+	kfree(km, mem);
+	if (!approx_max) kfree(km, H);
+	if (with_cigar) { // backtrack
+		int rev_cigar = !!(flag & KSW_EZ_REV_CIGAR);
+		if (!ez->zdropped && !(flag&KSW_EZ_EXTZ_ONLY)) {
+			ksw_backtrack(km, 1, rev_cigar, 0, p, off, off_end, n_colb, tlen-1, qlen-1, &ez->m_cigar, &ez->n_cigar, &ez->cigar);
+		} else if (!ez->zdropped && (flag&KSW_EZ_EXTZ_ONLY) && ez->mqe + end_bonus > (int)ez->max) {
+			ez->reach_end = 1;
+			ksw_backtrack(km, 1, rev_cigar, 0, p, off, off_end, n_colb, ez->mqe_t, qlen-1, &ez->m_cigar, &ez->n_cigar, &ez->cigar);
+		} else if (ez->max_t >= 0 && ez->max_q >= 0) {
+			ksw_backtrack(km, 1, rev_cigar, 0, p, off, off_end, n_colb, ez->max_t, ez->max_q, &ez->m_cigar, &ez->n_cigar, &ez->cigar);
+		}
+		kfree(km, mem2); kfree(km, off);
+	}
+}
+#endif // __AVX2__
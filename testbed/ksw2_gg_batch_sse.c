@@ -0,0 +1,140 @@
+#include <string.h>
+#include <assert.h>
+#include <emmintrin.h>
+#include "ksw2.h"
+
+#define KSW_GGB_N 8 // number of problems aligned together; one per 16-bit lane
+
+static inline int ksw_ggb_hb(int l, int8_t q, int8_t e, int8_t q2, int8_t e2) // score of a leading gap of length l
+{
+	int s1 = -(q + e * l), s2 = -(q2 + e2 * l);
+	return s1 > s2? s1 : s2;
+}
+
+// the same as ksw_backtrack(), reading one lane of the interleaved matrix
+static void ksw_ggb_backtrack(void *km, const int16_t *p, int n_col, int i, int j, ksw_ggb_t *b)
+{
+	int n_cigar = 0, m_cigar = b->m_cigar, state = 0, tmp;
+	uint32_t *cigar = b->cigar;
+	while (i >= 0 && j >= 0) {
+		tmp = p[((size_t)i * n_col + j) * KSW_GGB_N];
+		if (state == 0) state = tmp & 7;
+		else if (!(tmp >> (state + 2) & 1)) state = 0;
+		if (state == 0) state = tmp & 7;
+		if (state == 0) cigar = ksw_push_cigar(km, &n_cigar, &m_cigar, cigar, 0, 1), --i, --j; // match
+		else if (state == 1 || state == 3) cigar = ksw_push_cigar(km, &n_cigar, &m_cigar, cigar, 2, 1), --i; // deletion
+		else cigar = ksw_push_cigar(km, &n_cigar, &m_cigar, cigar, 1, 1), --j; // insertion
+	}
+	if (i >= 0) cigar = ksw_push_cigar(km, &n_cigar, &m_cigar, cigar, 2, i + 1);
+	if (j >= 0) cigar = ksw_push_cigar(km, &n_cigar, &m_cigar, cigar, 1, j + 1);
+	for (i = 0; i < n_cigar>>1; ++i) // reverse CIGAR
+		tmp = cigar[i], cigar[i] = cigar[n_cigar-1-i], cigar[n_cigar-1-i] = tmp;
+	b->m_cigar = m_cigar, b->n_cigar = n_cigar, b->cigar = cigar;
+}
+
+static void ksw_gg_batch1(void *km, int n, ksw_ggb_t *b, int8_t m, int8_t sc_mch, int8_t sc_mis, int8_t sc_N, int8_t q, int8_t e, int8_t q2, int8_t e2, int is_dual,
+						  int qmax, int tmax, __m128i *mem)
+{
+	int i, j, k, qlen = 0, tlen = 0;
+	int16_t qb[KSW_GGB_N], tb[KSW_GGB_N];
+	__m128i *qv = mem, *H = qv + qmax, *E = H + qmax, *E2 = E + qmax, *p = E2 + qmax;
+	__m128i q_ = _mm_set1_epi16(q), q2_ = _mm_set1_epi16(q2), e_ = _mm_set1_epi16(e), e2_ = _mm_set1_epi16(e2);
+	__m128i sc_mch_ = _mm_set1_epi16(sc_mch), sc_mis_ = _mm_set1_epi16(sc_mis), sc_N_ = _mm_set1_epi16(sc_N), m1_ = _mm_set1_epi16(m - 1);
+
+	for (k = 0; k < n; ++k) {
+		qlen = qlen > b[k].qlen? qlen : b[k].qlen;
+		tlen = tlen > b[k].tlen? tlen : b[k].tlen;
+	}
+	assert(qlen <= qmax && tlen <= tmax); // the backtrack matrix p[] holds qmax * tmax cells
+	for (j = 0; j < qlen; ++j) { // interleaved query; padded cells are never backtracked
+		for (k = 0; k < KSW_GGB_N; ++k)
+			qb[k] = k < n && j < b[k].qlen? b[k].query[j] : 0;
+		qv[j] = _mm_loadu_si128((__m128i*)qb);
+	}
+	for (j = 0; j < qlen; ++j) { // row -1
+		int h = ksw_ggb_hb(j + 1, q, e, q2, e2);
+		H[j]  = _mm_set1_epi16(h);
+		E[j]  = _mm_set1_epi16(h - q - e);
+		E2[j] = _mm_set1_epi16(h - q2 - e2);
+	}
+	for (i = 0; i < tlen; ++i) {
+		int h = ksw_ggb_hb(i + 1, q, e, q2, e2);
+		__m128i tv, Hd, F, F2, *pr = p + (size_t)i * qlen;
+		for (k = 0; k < KSW_GGB_N; ++k)
+			tb[k] = k < n && i < b[k].tlen? b[k].target[i] : 0;
+		tv = _mm_loadu_si128((__m128i*)tb);
+		Hd = _mm_set1_epi16(i? ksw_ggb_hb(i, q, e, q2, e2) : 0);
+		F  = _mm_set1_epi16(h - q - e);
+		F2 = _mm_set1_epi16(h - q2 - e2);
+		for (j = 0; j < qlen; ++j) { // the same recurrence and tie-breaking as ksw_extz2_sse() and ksw_extd2_sse()
+			__m128i z, d, tmp, sc, Ht = H[j], Et = E[j], Hq;
+			tmp = _mm_or_si128(_mm_cmpeq_epi16(qv[j], m1_), _mm_cmpeq_epi16(tv, m1_));
+			sc = _mm_cmpeq_epi16(qv[j], tv);
+			sc = _mm_or_si128(_mm_and_si128(sc, sc_mch_), _mm_andnot_si128(sc, sc_mis_));
+			sc = _mm_or_si128(_mm_and_si128(tmp, sc_N_), _mm_andnot_si128(tmp, sc));
+			z = _mm_add_epi16(Hd, sc);
+			tmp = _mm_cmpgt_epi16(Et, z);
+			d = _mm_and_si128(tmp, _mm_set1_epi16(1));                                            // d = E > z? 1 : 0
+			z = _mm_max_epi16(z, Et);
+			tmp = _mm_cmpgt_epi16(F, z);
+			d = _mm_or_si128(_mm_andnot_si128(tmp, d), _mm_and_si128(tmp, _mm_set1_epi16(2)));   // d = F > z? 2 : d
+			z = _mm_max_epi16(z, F);
+			if (is_dual) {
+				__m128i E2t = E2[j];
+				tmp = _mm_cmpgt_epi16(E2t, z);
+				d = _mm_or_si128(_mm_andnot_si128(tmp, d), _mm_and_si128(tmp, _mm_set1_epi16(3))); // d = E2 > z? 3 : d
+				z = _mm_max_epi16(z, E2t);
+				tmp = _mm_cmpgt_epi16(F2, z);
+				d = _mm_or_si128(_mm_andnot_si128(tmp, d), _mm_and_si128(tmp, _mm_set1_epi16(4))); // d = F2 > z? 4 : d
+				z = _mm_max_epi16(z, F2);
+				Hq = _mm_sub_epi16(z, q2_);
+				tmp = _mm_cmpgt_epi16(E2t, Hq);
+				d = _mm_or_si128(d, _mm_and_si128(tmp, _mm_set1_epi16(0x20)));
+				E2[j] = _mm_sub_epi16(_mm_max_epi16(E2t, Hq), e2_);
+				tmp = _mm_cmpgt_epi16(F2, Hq);
+				d = _mm_or_si128(d, _mm_and_si128(tmp, _mm_set1_epi16(0x40)));
+				F2 = _mm_sub_epi16(_mm_max_epi16(F2, Hq), e2_);
+			}
+			Hq = _mm_sub_epi16(z, q_);
+			tmp = _mm_cmpgt_epi16(Et, Hq);
+			d = _mm_or_si128(d, _mm_and_si128(tmp, _mm_set1_epi16(0x08)));                       // d = E > H-q? 0x08 : 0
+			E[j] = _mm_sub_epi16(_mm_max_epi16(Et, Hq), e_);
+			tmp = _mm_cmpgt_epi16(F, Hq);
+			d = _mm_or_si128(d, _mm_and_si128(tmp, _mm_set1_epi16(0x10)));                       // d = F > H-q? 0x10 : 0
+			F = _mm_sub_epi16(_mm_max_epi16(F, Hq), e_);
+			_mm_storeu_si128(&pr[j], d);
+			H[j] = z, Hd = Ht;
+		}
+		for (k = 0; k < n; ++k)
+			if (b[k].tlen == i + 1)
+				b[k].score = ((int16_t*)&H[b[k].qlen - 1])[k];
+	}
+	for (k = 0; k < n; ++k)
+		ksw_ggb_backtrack(km, (const int16_t*)p + k, qlen, b[k].tlen - 1, b[k].qlen - 1, &b[k]);
+}
+
+void ksw_gg_batch_sse(void *km, int n, ksw_ggb_t *b, int8_t m, const int8_t *mat, int8_t q, int8_t e, int8_t q2, int8_t e2)
+{
+	int i, t, qmax = 0, tmax = 0, min_sc, is_dual = !(q == q2 && e == e2);
+	int8_t sc_N;
+	uint8_t *mem0;
+	__m128i *mem;
+
+	for (i = 0; i < n; ++i) {
+		b[i].score = KSW_NEG_INF, b[i].n_cigar = 0;
+		qmax = qmax > b[i].qlen? qmax : b[i].qlen;
+		tmax = tmax > b[i].tlen? tmax : b[i].tlen;
+	}
+	if (m <= 1) return;
+	if (is_dual && q2 + e2 < q + e) t = q, q = q2, q2 = t, t = e, e = e2, e2 = t; // as in ksw_extd2_sse()
+	for (t = 1, min_sc = mat[1]; t < m * m; ++t)
+		min_sc = min_sc < mat[t]? min_sc : mat[t];
+	if (-min_sc > 2 * (q + e)) return;
+	sc_N = mat[m*m-1] == 0? -(is_dual? e2 : e) : mat[m*m-1];
+
+	mem0 = (uint8_t*)kmalloc(km, ((size_t)qmax * 4 + (size_t)qmax * tmax + 1) * 16);
+	mem = (__m128i*)(((size_t)mem0 + 15) >> 4 << 4); // 16-byte aligned
+	for (i = 0; i < n; i += KSW_GGB_N)
+		ksw_gg_batch1(km, n - i < KSW_GGB_N? n - i : KSW_GGB_N, &b[i], m, mat[0], mat[1], sc_N, q, e, q2, e2, is_dual, qmax, tmax, mem);
+	kfree(km, mem0);
+}
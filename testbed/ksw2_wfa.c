@@ -0,0 +1,181 @@
+#include <string.h>
+#include "ksw2.h"
+
+#define WF_NULL (-0x40000000)
+
+/* Gap-affine wavefront alignment (Marco-Sola et al., 2021) with two gap
+ * penalties. Scores are turned into penalties as in Eizenga and Paten
+ * (2022): with match score a, a mismatch costs 2(a+b), a gap of length l
+ * costs min(2q+l(2e+a), 2q2+l(2e2+a)), and score = (a(qlen+tlen)-pen)/2.
+ *
+ * Diagonal k = t - q; a wavefront stores the furthest target offset on each
+ * diagonal. I consumes the query (k-1) and D the target (k+1). */
+
+typedef struct {
+	int lo, hi;       // diagonal range; lo > hi if the wavefront is empty
+	int32_t *c[5];    // M, I, D, I2 and D2 offsets
+} ksw_wf_t;
+
+enum { WF_M = 0, WF_I, WF_D, WF_I2, WF_D2 };
+
+static inline int32_t wf_get(const ksw_wf_t *w, int s, int c, int k)
+{
+	if (s < 0 || w[s].lo > w[s].hi || k < w[s].lo || k > w[s].hi) return WF_NULL;
+	return w[s].c[c][k - w[s].lo];
+}
+
+static inline int32_t wf_max(int32_t a, int32_t b) { return a > b? a : b; }
+
+static inline void wf_range(const ksw_wf_t *w, int s, int *lo, int *hi)
+{
+	if (s < 0 || w[s].lo > w[s].hi) return;
+	if (w[s].lo < *lo) *lo = w[s].lo;
+	if (w[s].hi > *hi) *hi = w[s].hi;
+}
+
+static inline int32_t wf_valid(int32_t h, int k, int qlen, int tlen) // WF_NULL if offset _h_ is outside the matrix
+{
+	return h >= 0 && h <= tlen && h - k >= 0 && h - k <= qlen? h : WF_NULL;
+}
+
+typedef struct {
+	int lo, hi;
+	const int32_t *c;
+} wf_src_t;
+
+static inline void wf_src(const ksw_wf_t *w, int s, int c, wf_src_t *r)
+{
+	if (s < 0 || w[s].lo > w[s].hi) r->lo = 1, r->hi = 0, r->c = 0;
+	else r->lo = w[s].lo, r->hi = w[s].hi, r->c = w[s].c[c];
+}
+
+#define wf_at(r, k) ((k) >= (r).lo && (k) <= (r).hi? (r).c[(k) - (r).lo] : WF_NULL)
+
+// compute the wavefront of penalty _s_ from the smaller ones, before extending matches
+static void wf_next(void *km, ksw_wf_t *w, int s, int qlen, int tlen, int x, int oe1, int e1, int oe2, int e2)
+{
+	int k, lo = tlen + 1, hi = -qlen - 1;
+	wf_src_t mx, mo1, i1, d1, mo2, i2, d2;
+	ksw_wf_t *p = &w[s];
+	wf_src(w, s - x, WF_M, &mx);
+	wf_src(w, s - oe1, WF_M, &mo1), wf_src(w, s - e1, WF_I, &i1), wf_src(w, s - e1, WF_D, &d1);
+	wf_src(w, s - oe2, WF_M, &mo2), wf_src(w, s - e2, WF_I2, &i2), wf_src(w, s - e2, WF_D2, &d2);
+	wf_range(w, s - x, &lo, &hi);
+	wf_range(w, s - oe1, &lo, &hi);
+	wf_range(w, s - e1, &lo, &hi);
+	wf_range(w, s - oe2, &lo, &hi);
+	wf_range(w, s - e2, &lo, &hi);
+	p->lo = 1, p->hi = 0;
+	if (lo > hi) return;
+	lo = lo - 1 > -qlen? lo - 1 : -qlen;
+	hi = hi + 1 < tlen? hi + 1 : tlen;
+	if (lo > hi) return;
+	p->lo = lo, p->hi = hi;
+	p->c[0] = (int32_t*)kmalloc(km, (hi - lo + 1) * 5 * sizeof(int32_t));
+	for (k = 1; k < 5; ++k) p->c[k] = p->c[k-1] + (hi - lo + 1);
+	for (k = lo; k <= hi; ++k) {
+		int32_t ins, del, ins2, del2, mis, m;
+		ins  = wf_valid(wf_max(wf_at(mo1, k + 1), wf_at(i1, k + 1)), k, qlen, tlen);
+		del  = wf_valid(wf_max(wf_at(mo1, k - 1), wf_at(d1, k - 1)) + 1, k, qlen, tlen);
+		ins2 = wf_valid(wf_max(wf_at(mo2, k + 1), wf_at(i2, k + 1)), k, qlen, tlen);
+		del2 = wf_valid(wf_max(wf_at(mo2, k - 1), wf_at(d2, k - 1)) + 1, k, qlen, tlen);
+		mis  = wf_valid(wf_at(mx, k) + 1, k, qlen, tlen);
+		m = wf_max(wf_max(mis, ins), wf_max(wf_max(del, ins2), del2));
+		p->c[WF_M][k-lo] = m, p->c[WF_I][k-lo] = ins, p->c[WF_D][k-lo] = del, p->c[WF_I2][k-lo] = ins2, p->c[WF_D2][k-lo] = del2;
+	}
+}
+
+static void wf_extend(ksw_wf_t *p, int qlen, const uint8_t *query, int tlen, const uint8_t *target)
+{
+	int k;
+	for (k = p->lo; k <= p->hi; ++k) {
+		int32_t h = p->c[WF_M][k - p->lo], v;
+		if (h < 0) continue;
+		for (v = h - k; h < tlen && v < qlen && query[v] == target[h]; ++h, ++v);
+		p->c[WF_M][k - p->lo] = h;
+	}
+}
+
+// walk back from the end; on ties, prefer a mismatch over a gap and opening a gap over extending one, as ksw_backtrack() does
+static void wf_backtrack(void *km, const ksw_wf_t *w, int s, int k, int32_t h, int qlen, int tlen, int x, int oe1, int e1, int oe2, int e2, ksw_extz_t *ez)
+{
+	int c = WF_M;
+	while (1) {
+		if (c == WF_M) {
+			int32_t h0, mis, ins, del, ins2, del2;
+			if (s == 0) { // must be on diagonal 0
+				if (h > 0) ez->cigar = ksw_push_cigar(km, &ez->n_cigar, &ez->m_cigar, ez->cigar, 0, h);
+				break;
+			}
+			mis = wf_valid(wf_get(w, s - x, WF_M, k) + 1, k, qlen, tlen);
+			ins = wf_get(w, s, WF_I, k), del = wf_get(w, s, WF_D, k);
+			ins2 = wf_get(w, s, WF_I2, k), del2 = wf_get(w, s, WF_D2, k);
+			h0 = wf_max(wf_max(mis, ins), wf_max(wf_max(del, ins2), del2));
+			if (h > h0) ez->cigar = ksw_push_cigar(km, &ez->n_cigar, &ez->m_cigar, ez->cigar, 0, h - h0);
+			h = h0;
+			if (mis == h) {
+				ez->cigar = ksw_push_cigar(km, &ez->n_cigar, &ez->m_cigar, ez->cigar, 0, 1);
+				s -= x, --h;
+			} else if (del == h) c = WF_D;
+			else if (ins == h) c = WF_I;
+			else if (del2 == h) c = WF_D2;
+			else c = WF_I2;
+		} else if (c == WF_D || c == WF_D2) {
+			int oe = c == WF_D? oe1 : oe2, e = c == WF_D? e1 : e2;
+			ez->cigar = ksw_push_cigar(km, &ez->n_cigar, &ez->m_cigar, ez->cigar, 2, 1);
+			--h, --k;
+			if (wf_get(w, s - oe, WF_M, k) == h) s -= oe, c = WF_M;
+			else s -= e;
+		} else {
+			int oe = c == WF_I? oe1 : oe2, e = c == WF_I? e1 : e2;
+			ez->cigar = ksw_push_cigar(km, &ez->n_cigar, &ez->m_cigar, ez->cigar, 1, 1);
+			++k;
+			if (wf_get(w, s - oe, WF_M, k) == h) s -= oe, c = WF_M;
+			else s -= e;
+		}
+	}
+}
+
+int ksw_wfa(void *km, int qlen, const uint8_t *query, int tlen, const uint8_t *target, int8_t m, const int8_t *mat,
+			int8_t q, int8_t e, int8_t q2, int8_t e2, int max_pen, int flag, ksw_extz_t *ez)
+{
+	int i, s, n_s, ret = 0, k_end = tlen - qlen, a = mat[0], x = 2 * (mat[0] - mat[1]);
+	int oe1 = 2 * q + 2 * e + a, e1 = 2 * e + a, oe2 = 2 * q2 + 2 * e2 + a, e2_ = 2 * e2 + a;
+	ksw_wf_t *w;
+
+	ksw_reset_extz(ez);
+	if (qlen <= 0 || tlen <= 0) return 0;
+	for (i = 0; i < qlen; ++i) if (query[i] >= m - 1) return 0; // only plain mismatches have a fixed penalty
+	for (i = 0; i < tlen; ++i) if (target[i] >= m - 1) return 0;
+	w = (ksw_wf_t*)kcalloc(km, max_pen + 1, sizeof(ksw_wf_t));
+	for (s = 0; s <= max_pen; ++s) {
+		ksw_wf_t *p = &w[s];
+		if (s == 0) {
+			p->lo = p->hi = 0;
+			p->c[0] = (int32_t*)kmalloc(km, 5 * sizeof(int32_t));
+			for (i = 1; i < 5; ++i) p->c[i] = p->c[i-1] + 1, p->c[i][0] = WF_NULL;
+			p->c[WF_M][0] = 0;
+		} else wf_next(km, w, s, qlen, tlen, x, oe1, e1, oe2, e2_);
+		if (p->lo > p->hi) continue;
+		wf_extend(p, qlen, query, tlen, target);
+		if (k_end >= p->lo && k_end <= p->hi && p->c[WF_M][k_end - p->lo] == tlen) {
+			ret = 1;
+			break;
+		}
+	}
+	n_s = s < max_pen? s + 1 : max_pen + 1;
+	if (ret) {
+		wf_backtrack(km, w, s, k_end, tlen, qlen, tlen, x, oe1, e1, oe2, e2_, ez);
+		if (!(flag & KSW_EZ_REV_CIGAR))
+			for (i = 0; i < ez->n_cigar>>1; ++i) {
+				uint32_t t = ez->cigar[i];
+				ez->cigar[i] = ez->cigar[ez->n_cigar-1-i], ez->cigar[ez->n_cigar-1-i] = t;
+			}
+		ez->score = (a * (qlen + tlen) - s) / 2;
+		ez->max_q = qlen - 1, ez->max_t = tlen - 1;
+	}
+	for (i = 0; i < n_s; ++i)
+		if (w[i].lo <= w[i].hi) kfree(km, w[i].c[0]);
+	kfree(km, w);
+	return ret;
+}
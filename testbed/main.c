@@ -60,6 +60,16 @@ static ko_longopt_t long_options[] = {
 	{ "split-prefix",   ko_required_argument, 334 },
 	{ "no-end-flt",     ko_no_argument,       335 },
 	{ "hard-mask-level",ko_no_argument,       336 },
+	{ "max-chain-iter", ko_required_argument, 337 },
+	{ "chain-threads",  ko_required_argument, 338 },
+	{ "idx-flat",       ko_no_argument,       339 },
+	{ "idx-pack",       ko_no_argument,       340 },
+	{ "numa",           ko_no_argument,       341 },
+	{ "idx-append",     ko_required_argument, 342 },
+	{ "idx-bloom",      ko_no_argument,       343 },
+	{ "aln-threads",    ko_required_argument, 344 },
+	{ "check-gap-fill", ko_no_argument,       348 },
+	{ "wfa-div",        ko_required_argument, 349 },
 	{ "help",           ko_no_argument,       'h' },
 	{ "max-intron-len", ko_required_argument, 'G' },
 	{ "version",        ko_no_argument,       'V' },
@@ -105,7 +115,7 @@ int main(int argc, char *argv[])
 	mm_mapopt_t opt;
 	mm_idxopt_t ipt;
 	int i, c, n_threads = 3, n_parts, old_best_n = -1;
-	char *fnw = 0, *rg = 0, *s;
+	char *fnw = 0, *fn_add = 0, *rg = 0, *s;
 	FILE *fp_help = stderr;
 	mm_idx_reader_t *idx_rdr;
 	mm_idx_t *mi;
@@ -172,14 +182,23 @@ int main(int argc, char *argv[])
 		else if (c == 304) mm_dbg_flag |= MM_DBG_PRINT_QNAME; // --print-qname
 		else if (c == 306) mm_dbg_flag |= MM_DBG_PRINT_QNAME | MM_DBG_PRINT_SEED, n_threads = 1; // --print-seed
 		else if (c == 307) opt.max_chain_skip = atoi(o.arg); // --max-chain-skip
+		else if (c == 337) opt.max_chain_iter = atoi(o.arg); // --max-chain-iter
+		else if (c == 338) opt.chain_n_threads = atoi(o.arg); // --chain-threads
 		else if (c == 308) opt.min_ksw_len = atoi(o.arg); // --min-dp-len
+		else if (c == 344) opt.aln_n_threads = atoi(o.arg); // --aln-threads
+		else if (c == 349) opt.max_wfa_div = atof(o.arg); // --wfa-div
 		else if (c == 309) mm_dbg_flag |= MM_DBG_PRINT_QNAME | MM_DBG_PRINT_ALN_SEQ, n_threads = 1; // --print-aln-seq
+		else if (c == 348) mm_dbg_flag |= MM_DBG_CHECK_GAP; // --check-gap-fill
 		else if (c == 310) opt.flag |= MM_F_SPLICE; // --splice
 		else if (c == 312) opt.flag |= MM_F_NO_LJOIN; // --no-long-join
 		else if (c == 313) opt.flag |= MM_F_SR; // --sr
 		else if (c == 317) opt.end_bonus = atoi(o.arg); // --end-bonus
 		else if (c == 318) opt.flag |= MM_F_INDEPEND_SEG; // --no-pairing
 		else if (c == 320) ipt.flag |= MM_I_NO_SEQ; // --idx-no-seq
+		else if (c == 339) ipt.flag |= MM_I_FLAT; // --idx-flat
+		else if (c == 340) ipt.flag |= MM_I_PACK; // --idx-pack
+		else if (c == 343) ipt.flag |= MM_I_BLOOM; // --idx-bloom
+		else if (c == 342) fn_add = o.arg; // --idx-append
 		else if (c == 321) opt.anchor_ext_shift = atoi(o.arg); // --end-seed-pen
 		else if (c == 322) opt.flag |= MM_F_FOR_ONLY; // --for-only
 		else if (c == 323) opt.flag |= MM_F_REV_ONLY; // --rev-only
@@ -193,6 +212,13 @@ int main(int argc, char *argv[])
 		else if (c == 334) opt.split_prefix = o.arg; // --split-prefix
 		else if (c == 335) opt.flag |= MM_F_NO_END_FLT; // --no-end-flt
 		else if (c == 336) opt.flag |= MM_F_HARD_MLEVEL; // --hard-mask-level
+		else if (c == 341) { // --numa
+#ifdef HAVE_NUMA
+			opt.flag |= MM_F_NUMA;
+#else
+			if (mm_verbose >= 2) fprintf(stderr, "[WARNING]\033[1;31m option '--numa' has no effect as minimap2 was compiled without NUMA support.\033[0m\n");
+#endif
+		}
 		else if (c == 314) { // --frag
 			yes_or_no(&opt, MM_F_FRAG_MODE, o.longidx, o.arg, 1);
 		} else if (c == 315) { // --secondary
@@ -284,6 +310,7 @@ int main(int argc, char *argv[])
 		fprintf(fp_help, "    -w INT       minizer window size [%d]\n", ipt.w);
 		fprintf(fp_help, "    -I NUM       split index for every ~NUM input bases [4G]\n");
 		fprintf(fp_help, "    -d FILE      dump index to FILE []\n");
+		fprintf(fp_help, "    --idx-bloom  keep a Bloom filter of minimizers; rebuilt at each load unless the index is flat (slow)\n");
 		fprintf(fp_help, "  Mapping:\n");
 		fprintf(fp_help, "    -f FLOAT     filter out top FLOAT fraction of repetitive minimizers [%g]\n", opt.mid_occ_frac);
 		fprintf(fp_help, "    -g NUM       stop chain enlongation if there are no minimizers in INT-bp [%d]\n", opt.max_gap);
@@ -338,6 +365,18 @@ int main(int argc, char *argv[])
 		fprintf(stderr, "[ERROR] failed to open file '%s'\n", argv[o.ind]);
 		return 1;
 	}
+	if (fn_add) {
+		if (!idx_rdr->is_idx) {
+			fprintf(stderr, "[ERROR] --idx-append requires a prebuilt index as the target\n");
+			mm_idx_reader_close(idx_rdr);
+			return 1;
+		} else if (mm_idx_is_idx(fn_add) != 0) {
+			fprintf(stderr, "[ERROR] '%s' is not a readable sequence file\n", fn_add);
+			mm_idx_reader_close(idx_rdr);
+			return 1;
+		}
+		idx_rdr->fn_add = fn_add;
+	}
 	if (!idx_rdr->is_idx && fnw == 0 && argc - o.ind < 2) {
 		fprintf(stderr, "[ERROR] missing input: please specify a query file to map or option -d to keep the index\n");
 		mm_idx_reader_close(idx_rdr);
@@ -365,6 +404,7 @@ int main(int argc, char *argv[])
 			fprintf(stderr, "[M::%s::%.3f*%.2f] loaded/built the index for %d target sequence(s)\n",
 					__func__, realtime() - mm_realtime0, cputime() / (realtime() - mm_realtime0), mi->n_seq);
 		if (argc != o.ind + 1) mm_mapopt_update(&opt, mi);
+		if (opt.flag & (MM_F_NO_DIAG|MM_F_NO_DUAL)) mm_idx_index_name(mi);
 		if (mm_verbose >= 3) mm_idx_stat(mi);
 		if (!(opt.flag & MM_F_FRAG_MODE)) {
 			for (i = o.ind + 1; i < argc; ++i)
@@ -8,9 +8,13 @@
 #include "mmpriv.h"
 #include "bseq.h"
 #include "khash.h"
+#ifdef HAVE_NUMA
+#include <numa.h>
+#endif
 
 struct mm_tbuf_s {
 	void *km;
+	sdust_buf_t *sdb; // kept across reads; allocated with malloc() so that it survives resets of _km_
 	int rep_len, frag_gap;
 };
 
@@ -25,6 +29,7 @@ mm_tbuf_t *mm_tbuf_init(void)
 void mm_tbuf_destroy(mm_tbuf_t *b)
 {
 	if (b == 0) return;
+	sdust_buf_destroy(b->sdb);
 	km_destroy(b->km);
 	free(b);
 }
@@ -34,51 +39,18 @@ void *mm_tbuf_get_km(mm_tbuf_t *b)
 	return b->km;
 }
 
-static int mm_dust_minier(void *km, int n, mm128_t *a, int l_seq, const char *seq, int sdust_thres)
+static void collect_minimizers(mm_tbuf_t *b, const mm_mapopt_t *opt, const mm_idx_t *mi, int n_segs, const int *qlens, const char **seqs, mm128_v *mv)
 {
-	int n_dreg, j, k, u = 0;
-	const uint64_t *dreg;
-	sdust_buf_t *sdb;
-	if (sdust_thres <= 0) return n;
-	sdb = sdust_buf_init(km);
-	dreg = sdust_core((const uint8_t*)seq, l_seq, sdust_thres, 64, &n_dreg, sdb);
-	for (j = k = 0; j < n; ++j) { // squeeze out minimizers that significantly overlap with LCRs
-		int32_t qpos = (uint32_t)a[j].y>>1, span = a[j].x&0xff;
-		int32_t s = qpos - (span - 1), e = s + span;
-		while (u < n_dreg && (int32_t)dreg[u] <= s) ++u;
-		if (u < n_dreg && (int32_t)(dreg[u]>>32) < e) {
-			int v, l = 0;
-			for (v = u; v < n_dreg && (int32_t)(dreg[v]>>32) < e; ++v) { // iterate over LCRs overlapping this minimizer
-				int ss = s > (int32_t)(dreg[v]>>32)? s : dreg[v]>>32;
-				int ee = e < (int32_t)dreg[v]? e : (uint32_t)dreg[v];
-				l += ee - ss;
-			}
-			if (l <= span>>1) a[k++] = a[j]; // keep the minimizer if less than half of it falls in masked region
-		} else a[k++] = a[j];
-	}
-	sdust_buf_destroy(sdb);
-	return k; // the new size
-}
-
-static void collect_minimizers(void *km, mm_mapopt_t *opt, const mm_idx_t *mi, int n_segs, const int *qlens, const char **seqs, mm128_v *mv)
-{
-	int i, n, sum = 0;
+	int i, sum = 0;
+	size_t j, off[MM_MAX_SEG + 1];
 	mv->n = 0;
-	for (i = n = 0; i < n_segs; ++i) {
-		size_t j;
-		mm_sketch(km, seqs[i], qlens[i], mi->w, mi->k, i, mi->flag&MM_I_HPC, mv);
-		for (j = n; j < mv->n; ++j)
+	if (opt->sdust_thres > 0 && b->sdb == 0) b->sdb = sdust_buf_init(0);
+	mm_sketch_batch(b->km, n_segs, seqs, qlens, 0, mi->w, mi->k, mi->flag&MM_I_HPC, opt->sdust_thres, b->sdb, mv, off);
+	for (i = 0; i < n_segs; sum += qlens[i++])
+		for (j = off[i]; j < off[i+1]; ++j)
 			mv->a[j].y += sum << 1;
-		if (opt->sdust_thres > 0) // mask low-complexity minimizers
-			mv->n = n + mm_dust_minier(km, mv->n - n, mv->a + n, qlens[i], seqs[i], opt->sdust_thres);
-		sum += qlens[i], n = mv->n;
-	}
 }
 
-#include "ksort.h"
-#define heap_lt(a, b) ((a).x > (b).x)
-KSORT_INIT(heap, mm128_t, heap_lt)
-
 typedef struct {
 	uint32_t n;
 	uint32_t q_pos, q_span;
@@ -86,20 +58,23 @@ typedef struct {
 	const uint64_t *cr;
 } mm_match_t;
 
-static mm_match_t *collect_matches(void *km, int *_n_m, int max_occ, const mm_idx_t *mi, const mm128_v *mv, int64_t *n_a, int *rep_len, int *n_mini_pos, uint64_t **mini_pos)
+static mm_match_t *collect_matches(void *km, int *_n_m, int max_occ, const mm_idx_t *mi, const mm128_v *mv, int64_t *n_a, int *rep_len, int *n_mini_pos, uint64_t **mini_pos, uint64_t **buf)
 {
 	int rep_st = 0, rep_en = 0, n_m;
 	size_t i;
 	mm_match_t *m;
+	const uint64_t **cr;
+	int *n_occ;
 	*n_mini_pos = 0;
 	*mini_pos = (uint64_t*)kmalloc(km, mv->n * sizeof(uint64_t));
 	m = (mm_match_t*)kmalloc(km, mv->n * sizeof(mm_match_t));
+	cr = (const uint64_t**)kmalloc(km, mv->n * sizeof(uint64_t*));
+	n_occ = (int*)kmalloc(km, mv->n * sizeof(int));
+	mm_idx_get_batch(mi, mv->n, mv->a, max_occ, cr, n_occ, km, buf); // *buf keeps decoded lists of a packed index
 	for (i = 0, n_m = 0, *rep_len = 0, *n_a = 0; i < mv->n; ++i) {
-		const uint64_t *cr;
 		mm128_t *p = &mv->a[i];
 		uint32_t q_pos = (uint32_t)p->y, q_span = p->x & 0xff;
-		int t;
-		cr = mm_idx_get(mi, p->x>>8, &t);
+		int t = n_occ[i];
 		if (t >= max_occ) {
 			int en = (q_pos >> 1) + 1, st = en - q_span;
 			if (st > rep_en) {
@@ -108,7 +83,7 @@ static mm_match_t *collect_matches(void *km, int *_n_m, int max_occ, const mm_id
 			} else rep_en = en;
 		} else {
 			mm_match_t *q = &m[n_m++];
-			q->q_pos = q_pos, q->q_span = q_span, q->cr = cr, q->n = t, q->seg_id = p->y >> 32;
+			q->q_pos = q_pos, q->q_span = q_span, q->cr = cr[i], q->n = t, q->seg_id = p->y >> 32;
 			q->is_tandem = 0;
 			if (i > 0 && p->x>>8 == mv->a[i - 1].x>>8) q->is_tandem = 1;
 			if (i < mv->n - 1 && p->x>>8 == mv->a[i + 1].x>>8) q->is_tandem = 1;
@@ -118,16 +93,18 @@ static mm_match_t *collect_matches(void *km, int *_n_m, int max_occ, const mm_id
 	}
 	*rep_len += rep_en - rep_st;
 	*_n_m = n_m;
+	kfree(km, cr); kfree(km, n_occ);
 	return m;
 }
 
-static inline int skip_seed(int flag, uint64_t r, const mm_match_t *q, const char *qname, int qlen, const mm_idx_t *mi, int *is_self)
+static inline int skip_seed(int flag, uint64_t r, const mm_match_t *q, const char *qname, uint32_t q_rank, int qlen, const mm_idx_t *mi, int *is_self)
 {
 	*is_self = 0;
 	if (qname && (flag & (MM_F_NO_DIAG|MM_F_NO_DUAL))) {
 		const mm_idx_seq_t *s = &mi->seq[r>>32];
 		int cmp;
-		cmp = strcmp(qname, s->name);
+		if (q_rank) cmp = (q_rank > mi->name_rank[r>>32]) - (q_rank < mi->name_rank[r>>32]); // the same sign as strcmp()
+		else cmp = strcmp(qname, s->name);
 		if ((flag&MM_F_NO_DIAG) && cmp == 0 && (int)s->len == qlen) {
 			if ((uint32_t)r>>1 == (q->q_pos>>1)) return 1; // avoid the diagnonal anchors
 			if ((r&1) == (q->q_pos&1)) *is_self = 1; // this flag is used to avoid spurious extension on self chain
@@ -145,104 +122,170 @@ static inline int skip_seed(int flag, uint64_t r, const mm_match_t *q, const cha
 	return 0;
 }
 
-static mm128_t *collect_seed_hits_heap(void *km, mm_mapopt_t *opt, int max_occ, const mm_idx_t *mi, const char *qname, const mm128_v *mv, int qlen, int64_t *n_a, int *rep_len,
-								  int *n_mini_pos, uint64_t **mini_pos)
+static void anchors_alloc(void *km, mm_anchors_t *a, int64_t n)
 {
-	int i, n_m, heap_size = 0;
-	int64_t j, n_for = 0, n_rev = 0;
-	mm_match_t *m;
-	mm128_t *a, *heap;
-
-	m = collect_matches(km, &n_m, max_occ, mi, mv, n_a, rep_len, n_mini_pos, mini_pos);
+	a->n = n;
+	a->tag = (uint32_t*)kmalloc(km, n * 15 + 1); // all arrays in one block; kfree(km, a->tag) frees them
+	a->x = (int32_t*)(a->tag + n);
+	a->y = a->x + n;
+	a->w = (uint8_t*)(a->y + n);
+	a->flag = a->w + n;
+	a->seg = a->flag + n;
+}
 
-	heap = (mm128_t*)kmalloc(km, n_m * sizeof(mm128_t));
-	a = (mm128_t*)kmalloc(km, *n_a * sizeof(mm128_t));
+static void anchors_move(mm_anchors_t *a, int64_t dst, int64_t src, int64_t n)
+{
+	memmove(&a->tag[dst], &a->tag[src], n * 4);
+	memmove(&a->x[dst], &a->x[src], n * 4);
+	memmove(&a->y[dst], &a->y[src], n * 4);
+	memmove(&a->w[dst], &a->w[src], n);
+	memmove(&a->flag[dst], &a->flag[src], n);
+	memmove(&a->seg[dst], &a->seg[src], n);
+}
 
-	for (i = 0, heap_size = 0; i < n_m; ++i) {
-		if (m[i].n > 0) {
-			heap[heap_size].x = m[i].cr[0];
-			heap[heap_size].y = (uint64_t)i<<32;
-			++heap_size;
-		}
-	}
-	ks_heapmake_heap(heap_size, heap);
-	while (heap_size > 0) {
-		mm_match_t *q = &m[heap->y>>32];
-		mm128_t *p;
-		uint64_t r = heap->x;
-		int32_t is_self, rpos = (uint32_t)r >> 1;
-		if (!skip_seed(opt->flag, r, q, qname, qlen, mi, &is_self)) {
-			if ((r&1) == (q->q_pos&1)) { // forward strand
-				p = &a[n_for++];
-				p->x = (r&0xffffffff00000000ULL) | rpos;
-				p->y = (uint64_t)q->q_span << 32 | q->q_pos >> 1;
-			} else { // reverse strand
-				p = &a[(*n_a) - (++n_rev)];
-				p->x = 1ULL<<63 | (r&0xffffffff00000000ULL) | rpos;
-				p->y = (uint64_t)q->q_span << 32 | (qlen - ((q->q_pos>>1) + 1 - q->q_span) - 1);
-			}
-			p->y |= (uint64_t)q->seg_id << MM_SEED_SEG_SHIFT;
-			if (q->is_tandem) p->y |= MM_SEED_TANDEM;
-			if (is_self) p->y |= MM_SEED_SELF;
-		}
-		// update the heap
-		if ((uint32_t)heap->y < q->n - 1) {
-			++heap[0].y;
-			heap[0].x = m[heap[0].y>>32].cr[(uint32_t)heap[0].y];
-		} else {
-			heap[0] = heap[heap_size - 1];
-			--heap_size;
-		}
-		ks_heapdown_heap(0, heap_size, heap);
+static void anchors_reverse(mm_anchors_t *a, int64_t st, int64_t en)
+{
+	int64_t i, j;
+	for (i = st, j = en - 1; i < j; ++i, --j) {
+		uint32_t t32;
+		uint8_t t8;
+		t32 = a->tag[i], a->tag[i] = a->tag[j], a->tag[j] = t32;
+		t32 = a->x[i], a->x[i] = a->x[j], a->x[j] = t32;
+		t32 = a->y[i], a->y[i] = a->y[j], a->y[j] = t32;
+		t8 = a->w[i], a->w[i] = a->w[j], a->w[j] = t8;
+		t8 = a->flag[i], a->flag[i] = a->flag[j], a->flag[j] = t8;
+		t8 = a->seg[i], a->seg[i] = a->seg[j], a->seg[j] = t8;
 	}
-	kfree(km, m);
-	kfree(km, heap);
+}
 
-	// reverse anchors on the reverse strand, as they are in the descending order
-	for (j = 0; j < n_rev>>1; ++j) {
-		mm128_t t = a[(*n_a) - 1 - j];
-		a[(*n_a) - 1 - j] = a[(*n_a) - (n_rev - j)];
-		a[(*n_a) - (n_rev - j)] = t;
-	}
-	if (*n_a > n_for + n_rev) {
-		memmove(a + n_for, a + (*n_a) - n_rev, n_rev * sizeof(mm128_t));
-		*n_a = n_for + n_rev;
+static inline void merge_put_hit(mm_mapopt_t *opt, const mm_idx_t *mi, const char *qname, uint32_t q_rank, int qlen, uint64_t r, const mm_match_t *q, mm_anchors_t *a, int64_t *n_for, int64_t *n_rev)
+{
+	int32_t is_self;
+	int64_t i;
+	if (skip_seed(opt->flag, r, q, qname, q_rank, qlen, mi, &is_self)) return;
+	if ((r&1) == (q->q_pos&1)) { // forward strand; written from the start of a[]
+		i = (*n_for)++;
+		a->tag[i] = r>>32;
+		a->y[i] = q->q_pos >> 1;
+	} else { // reverse strand; written from the end of a[], in the descending order
+		i = a->n - (++*n_rev);
+		a->tag[i] = 1U<<31 | r>>32;
+		a->y[i] = qlen - ((q->q_pos>>1) + 1 - q->q_span) - 1;
 	}
-	return a;
+	a->x[i] = (uint32_t)r >> 1;
+	a->w[i] = q->q_span;
+	a->flag[i] = (q->is_tandem? MM_SEED_TANDEM>>40 : 0) | (is_self? MM_SEED_SELF>>40 : 0);
+	a->seg[i] = q->seg_id;
+}
+
+#include "ksort.h"
+#define heap_lt(a, b) ((a).x > (b).x)
+KSORT_INIT(heap, mm128_t, heap_lt)
+
+#define MM_MERGE_SCAN_MAX 8 // with no more lists than this, find the smallest head by a linear scan instead of a loser tree
+
+// Anchors at the same reference position and strand are ordered by the y of
+// an mm128_t anchor: segment, tandem flag, span, then query position. This is
+// the order of a full sort of 128-bit anchors; MM_SEED_SELF is the same for
+// all of them and is left out.
+static inline uint64_t merge_qkey(const mm_match_t *q, uint64_t r, int qlen)
+{
+	uint64_t y = (uint64_t)q->seg_id << MM_SEED_SEG_SHIFT | (q->is_tandem? MM_SEED_TANDEM : 0) | (uint64_t)q->q_span << 32;
+	return y | ((r&1) == (q->q_pos&1)? q->q_pos >> 1 : qlen - ((q->q_pos>>1) + 1 - q->q_span) - 1);
+}
+
+static inline int merge_lt(const uint64_t *key, const mm_match_t *m, int qlen, int a, int b)
+{
+	int ra, rb;
+	if (key[a]>>1 != key[b]>>1) return key[a] < key[b];
+	ra = (key[a]&1) != (m[a].q_pos&1), rb = (key[b]&1) != (m[b].q_pos&1);
+	if (ra != rb) return ra < rb;
+	return merge_qkey(&m[a], key[a], qlen) < merge_qkey(&m[b], key[b], qlen);
 }
 
-static mm128_t *collect_seed_hits(void *km, mm_mapopt_t *opt, int max_occ, const mm_idx_t *mi, const char *qname, const mm128_v *mv, int qlen, int64_t *n_a, int *rep_len,
-								  int *n_mini_pos, uint64_t **mini_pos)
+/* Generate anchors by a k-way merge of the occurrence lists. Each list
+ * returned by mm_idx_get() is sorted by reference position, so the merged
+ * stream is sorted, too, and both the forward and the reverse anchors are
+ * produced in order without a full sort of a[]. */
+static void collect_seed_hits(void *km, mm_mapopt_t *opt, int max_occ, const mm_idx_t *mi, const char *qname, uint32_t q_rank, const mm128_v *mv, int qlen, mm_anchors_t *a, int *rep_len,
+							  int *n_mini_pos, uint64_t **mini_pos)
 {
-	int i, n_m;
+	int i, k, n_m, win;
+	int64_t n_a, n_for = 0, n_rev = 0, n_left;
+	uint32_t *cur;
+	uint64_t *key, *buf;
 	mm_match_t *m;
-	mm128_t *a;
-	m = collect_matches(km, &n_m, max_occ, mi, mv, n_a, rep_len, n_mini_pos, mini_pos);
-	a = (mm128_t*)kmalloc(km, *n_a * sizeof(mm128_t));
-	for (i = 0, *n_a = 0; i < n_m; ++i) {
-		mm_match_t *q = &m[i];
-		const uint64_t *r = q->cr;
-		uint32_t k;
-		for (k = 0; k < q->n; ++k) {
-			int32_t is_self, rpos = (uint32_t)r[k] >> 1;
-			mm128_t *p;
-			if (skip_seed(opt->flag, r[k], q, qname, qlen, mi, &is_self)) continue;
-			p = &a[(*n_a)++];
-			if ((r[k]&1) == (q->q_pos&1)) { // forward strand
-				p->x = (r[k]&0xffffffff00000000ULL) | rpos;
-				p->y = (uint64_t)q->q_span << 32 | q->q_pos >> 1;
-			} else { // reverse strand
-				p->x = 1ULL<<63 | (r[k]&0xffffffff00000000ULL) | rpos;
-				p->y = (uint64_t)q->q_span << 32 | (qlen - ((q->q_pos>>1) + 1 - q->q_span) - 1);
+
+	m = collect_matches(km, &n_m, max_occ, mi, mv, &n_a, rep_len, n_mini_pos, mini_pos, &buf);
+	anchors_alloc(km, a, n_a);
+
+	// squeeze out empty lists; k is the fan-in of the merge
+	for (i = k = 0; i < n_m; ++i)
+		if (m[i].n > 0) m[k++] = m[i];
+	key = (uint64_t*)kmalloc(km, (k + 1) * sizeof(uint64_t));
+	cur = (uint32_t*)kcalloc(km, k + 1, sizeof(uint32_t));
+	for (i = 0; i < k; ++i) key[i] = m[i].cr[0];
+
+	n_left = n_a;
+	if (opt->flag & MM_F_HEAP_SORT) { // a binary heap on x alone, which puts anchors of equal x in the same order as --heap-sort did
+		mm128_t *heap;
+		int heap_size = k;
+		heap = (mm128_t*)kmalloc(km, k * sizeof(mm128_t));
+		for (i = 0; i < k; ++i)
+			heap[i].x = key[i], heap[i].y = (uint64_t)i<<32;
+		ks_heapmake_heap(heap_size, heap);
+		while (heap_size > 0) {
+			win = heap->y>>32;
+			merge_put_hit(opt, mi, qname, q_rank, qlen, heap->x, &m[win], a, &n_for, &n_rev);
+			if (++cur[win] < m[win].n) heap->x = m[win].cr[cur[win]];
+			else heap[0] = heap[--heap_size];
+			ks_heapdown_heap(0, heap_size, heap);
+		}
+		kfree(km, heap);
+	} else if (k <= MM_MERGE_SCAN_MAX) { // small fan-in: the heads fit in one or two cache lines
+		while (n_left > 0) {
+			for (i = 1, win = 0; i < k; ++i)
+				if (merge_lt(key, m, qlen, i, win)) win = i;
+			merge_put_hit(opt, mi, qname, q_rank, qlen, key[win], &m[win], a, &n_for, &n_rev);
+			key[win] = ++cur[win] < m[win].n? m[win].cr[cur[win]] : UINT64_MAX;
+			--n_left;
+		}
+	} else { // large fan-in: a loser tree takes log2(k) comparisons per anchor
+		int t, *lt, *w;
+		lt = (int*)kmalloc(km, k * sizeof(int));
+		w = (int*)kmalloc(km, 2 * k * sizeof(int));
+		for (i = 0; i < k; ++i) w[k + i] = i;
+		for (t = k - 1; t >= 1; --t) { // build the tree bottom up; lt[t] keeps the loser at node t
+			int l = w[t<<1], r = w[t<<1|1];
+			if (merge_lt(key, m, qlen, l, r)) w[t] = l, lt[t] = r;
+			else w[t] = r, lt[t] = l;
+		}
+		win = w[1];
+		kfree(km, w);
+		while (n_left > 0) {
+			merge_put_hit(opt, mi, qname, q_rank, qlen, key[win], &m[win], a, &n_for, &n_rev);
+			key[win] = ++cur[win] < m[win].n? m[win].cr[cur[win]] : UINT64_MAX;
+			--n_left;
+			for (t = (win + k) >> 1; t > 0; t >>= 1) { // replay the matches on the path to the root
+				if (merge_lt(key, m, qlen, lt[t], win)) {
+					int tmp = lt[t];
+					lt[t] = win, win = tmp;
+				}
 			}
-			p->y |= (uint64_t)q->seg_id << MM_SEED_SEG_SHIFT;
-			if (q->is_tandem) p->y |= MM_SEED_TANDEM;
-			if (is_self) p->y |= MM_SEED_SELF;
 		}
+		kfree(km, lt);
 	}
+	kfree(km, key);
+	kfree(km, cur);
 	kfree(km, m);
-	radix_sort_128x(a, a + (*n_a));
-	return a;
+	kfree(km, buf);
+
+	// reverse anchors on the reverse strand, as they are in the descending order
+	anchors_reverse(a, n_a - n_rev, n_a);
+	if (n_a > n_for + n_rev) {
+		anchors_move(a, n_for, n_a - n_rev, n_rev);
+		a->n = n_for + n_rev;
+	}
 }
 
 static void chain_post(mm_mapopt_t *opt, int max_chain_gap_ref, const mm_idx_t *mi, void *km, int qlen, int n_segs, const int *qlens, int *n_regs, mm_reg1_t *regs, mm128_t *a)
@@ -272,10 +315,10 @@ void mm_map_frag(const mm_idx_t *mi, int n_segs, const int *qlens, const char **
 {
 	int i, j, rep_len, qlen_sum, n_regs0, n_mini_pos;
 	int max_chain_gap_qry, max_chain_gap_ref, is_splice = !!(opt->flag & MM_F_SPLICE), is_sr = !!(opt->flag & MM_F_SR);
-	uint32_t hash;
-	int64_t n_a;
+	uint32_t hash, q_rank = 0;
 	uint64_t *u, *mini_pos;
 	mm128_t *a;
+	mm_anchors_t sa;
 	mm128_v mv = {0,0,0};
 	mm_reg1_t *regs0;
 	km_stat_t kmst;
@@ -289,15 +332,17 @@ void mm_map_frag(const mm_idx_t *mi, int n_segs, const int *qlens, const char **
 	hash ^= __ac_Wang_hash(qlen_sum) + __ac_Wang_hash(opt->seed);
 	hash  = __ac_Wang_hash(hash);
 
-	collect_minimizers(b->km, opt, mi, n_segs, qlens, seqs, &mv);
-	if (opt->flag & MM_F_HEAP_SORT) a = collect_seed_hits_heap(b->km, opt, opt->mid_occ, mi, qname, &mv, qlen_sum, &n_a, &rep_len, &n_mini_pos, &mini_pos);
-	else a = collect_seed_hits(b->km, opt, opt->mid_occ, mi, qname, &mv, qlen_sum, &n_a, &rep_len, &n_mini_pos, &mini_pos);
+	if (qname && mi->name_rank && (opt->flag & (MM_F_NO_DIAG|MM_F_NO_DUAL))) // for integer comparisons in skip_seed()
+		q_rank = mm_idx_name_rank(mi, qname);
+
+	collect_minimizers(b, opt, mi, n_segs, qlens, seqs, &mv);
+	collect_seed_hits(b->km, opt, opt->mid_occ, mi, qname, q_rank, &mv, qlen_sum, &sa, &rep_len, &n_mini_pos, &mini_pos);
 
 	if (mm_dbg_flag & MM_DBG_PRINT_SEED) {
 		fprintf(stderr, "RS\t%d\n", rep_len);
-		for (i = 0; i < n_a; ++i)
-			fprintf(stderr, "SD\t%s\t%d\t%c\t%d\t%d\t%d\n", mi->seq[a[i].x<<1>>33].name, (int32_t)a[i].x, "+-"[a[i].x>>63], (int32_t)a[i].y, (int32_t)(a[i].y>>32&0xff),
-					i == 0? 0 : ((int32_t)a[i].y - (int32_t)a[i-1].y) - ((int32_t)a[i].x - (int32_t)a[i-1].x));
+		for (i = 0; i < sa.n; ++i)
+			fprintf(stderr, "SD\t%s\t%d\t%c\t%d\t%d\t%d\n", mi->seq[sa.tag[i]<<1>>1].name, sa.x[i], "+-"[sa.tag[i]>>31], sa.y[i], sa.w[i],
+					i == 0? 0 : (sa.y[i] - sa.y[i-1]) - (sa.x[i] - sa.x[i-1]));
 	}
 
 	// set max chaining gap on the query and the reference sequence
@@ -311,7 +356,7 @@ void mm_map_frag(const mm_idx_t *mi, int n_segs, const int *qlens, const char **
 		if (max_chain_gap_ref < opt->max_gap) max_chain_gap_ref = opt->max_gap;
 	} else max_chain_gap_ref = opt->max_gap;
 
-	a = mm_chain_dp(max_chain_gap_ref, max_chain_gap_qry, opt->bw, opt->max_chain_skip, opt->min_cnt, opt->min_chain_score, is_splice, n_segs, n_a, a, &n_regs0, &u, b->km, opt);
+	a = mm_chain_dp(max_chain_gap_ref, max_chain_gap_qry, opt->bw, opt->max_chain_skip, opt->max_chain_iter, opt->min_cnt, opt->min_chain_score, is_splice, n_segs, &sa, &n_regs0, &u, b->km, opt);
 
 	if (opt->max_occ > opt->mid_occ && rep_len > 0) {
 		int rechain = 0;
@@ -331,9 +376,8 @@ void mm_map_frag(const mm_idx_t *mi, int n_segs, const int *qlens, const char **
 			kfree(b->km, a);
 			kfree(b->km, u);
 			kfree(b->km, mini_pos);
-			if (opt->flag & MM_F_HEAP_SORT) a = collect_seed_hits_heap(b->km, opt, opt->max_occ, mi, qname, &mv, qlen_sum, &n_a, &rep_len, &n_mini_pos, &mini_pos);
-			else a = collect_seed_hits(b->km, opt, opt->max_occ, mi, qname, &mv, qlen_sum, &n_a, &rep_len, &n_mini_pos, &mini_pos);
-			a = mm_chain_dp(max_chain_gap_ref, max_chain_gap_qry, opt->bw, opt->max_chain_skip, opt->min_cnt, opt->min_chain_score, is_splice, n_segs, n_a, a, &n_regs0, &u, b->km, opt);
+			collect_seed_hits(b->km, opt, opt->max_occ, mi, qname, q_rank, &mv, qlen_sum, &sa, &rep_len, &n_mini_pos, &mini_pos);
+			a = mm_chain_dp(max_chain_gap_ref, max_chain_gap_qry, opt->bw, opt->max_chain_skip, opt->max_chain_iter, opt->min_cnt, opt->min_chain_score, is_splice, n_segs, &sa, &n_regs0, &u, b->km, opt);
 		}
 	}
 	b->frag_gap = max_chain_gap_ref;
@@ -403,6 +447,9 @@ typedef struct {
 	const mm_idx_t *mi;
 	kstring_t str;
 
+	int n_node;             // number of NUMA nodes used with MM_F_NUMA; 0 if not used
+	const mm_idx_t **mi_node; // per-node replicas of _mi_; mi_node[0] is _mi_
+
 	int n_parts;
 	uint32_t *rid_shift;
 	FILE *fp_split, **fp_parts;
@@ -417,13 +464,58 @@ typedef struct {
 	mm_tbuf_t **buf;
 } step_t;
 
+#ifdef HAVE_NUMA
+static __thread int mm_numa_node = -1; // node the current thread is bound to
+
+static const mm_idx_t *numa_bind_worker(const pipeline_t *p, int tid)
+{
+	if (mm_numa_node < 0) { // kt_for() threads are created per batch and bound on their first fragment
+		mm_numa_node = (long)tid * p->n_node / p->n_threads;
+		numa_run_on_node(mm_numa_node);
+		numa_set_preferred(mm_numa_node); // so that the thread-local kalloc pools are allocated locally
+	}
+	return p->mi_node[mm_numa_node];
+}
+
+static void worker_dup(void *data, long i, int tid) // kt_for() callback
+{
+	pipeline_t *p = (pipeline_t*)data;
+	numa_run_on_node(i + 1);
+	numa_set_preferred(i + 1); // first touch places the replica on node i+1
+	p->mi_node[i + 1] = p->mi->mm? p->mi : mm_idx_dup(p->mi); // pages of an mmap()ed index are shared anyway
+	numa_run_on_node(-1);
+	numa_set_localalloc();
+}
+
+static void numa_init(pipeline_t *p)
+{
+	if (numa_available() < 0 || numa_max_node() < 1 || p->n_threads <= numa_max_node()) return;
+	p->n_node = numa_max_node() + 1;
+	p->mi_node = (const mm_idx_t**)calloc(p->n_node, sizeof(mm_idx_t*));
+	p->mi_node[0] = p->mi;
+	kt_for(p->n_node - 1, worker_dup, p, p->n_node - 1);
+}
+
+static void numa_destroy(pipeline_t *p)
+{
+	int i;
+	for (i = 1; i < p->n_node; ++i)
+		if (p->mi_node[i] != p->mi) mm_idx_destroy((mm_idx_t*)p->mi_node[i]);
+	free(p->mi_node);
+}
+#endif
+
 static void worker_for(void *_data, long i, int tid) // kt_for() callback
 {
     step_t *s = (step_t*)_data;
 	int qlens[MM_MAX_SEG], j, off = s->seg_off[i], pe_ori = s->p->opt->pe_ori;
 	const char *qseqs[MM_MAX_SEG];
+	const mm_idx_t *mi = s->p->mi;
 	mm_tbuf_t *b = s->buf[tid];
 	assert(s->n_seg[i] <= MM_MAX_SEG);
+#ifdef HAVE_NUMA
+	if (s->p->n_node > 1) mi = numa_bind_worker(s->p, tid);
+#endif
 	if (mm_dbg_flag & MM_DBG_PRINT_QNAME)
 		fprintf(stderr, "QR\t%s\t%d\t%d\n", s->seq[off].name, tid, s->seq[off].l_seq);
 	for (j = 0; j < s->n_seg[i]; ++j) {
@@ -434,12 +526,12 @@ static void worker_for(void *_data, long i, int tid) // kt_for() callback
 	}
 	if (s->p->opt->flag & MM_F_INDEPEND_SEG) {
 		for (j = 0; j < s->n_seg[i]; ++j) {
-			mm_map_frag(s->p->mi, 1, &qlens[j], &qseqs[j], &s->n_reg[off+j], &s->reg[off+j], b, s->p->opt, s->seq[off+j].name);
+			mm_map_frag(mi, 1, &qlens[j], &qseqs[j], &s->n_reg[off+j], &s->reg[off+j], b, s->p->opt, s->seq[off+j].name);
 			s->rep_len[off + j] = b->rep_len;
 			s->frag_gap[off + j] = b->frag_gap;
 		}
 	} else {
-		mm_map_frag(s->p->mi, s->n_seg[i], qlens, qseqs, &s->n_reg[off], &s->reg[off], b, s->p->opt, s->seq[off].name);
+		mm_map_frag(mi, s->n_seg[i], qlens, qseqs, &s->n_reg[off], &s->reg[off], b, s->p->opt, s->seq[off].name);
 		for (j = 0; j < s->n_seg[i]; ++j) {
 			s->rep_len[off + j] = b->rep_len;
 			s->frag_gap[off + j] = b->frag_gap;
@@ -646,8 +738,14 @@ int mm_map_file_frag(const mm_idx_t *idx, int n_segs, const char **fn, mm_mapopt
 	if (opt->split_prefix)
 		pl.fp_split = mm_split_init(opt->split_prefix, idx);
 	pl_threads = n_threads == 1? 1 : (opt->flag&MM_F_2_IO_THREADS)? 3 : 2;
+#ifdef HAVE_NUMA
+	if (opt->flag & MM_F_NUMA) numa_init(&pl);
+#endif
 	kt_pipeline(pl_threads, worker_pipeline, &pl, 3);
 
+#ifdef HAVE_NUMA
+	numa_destroy(&pl);
+#endif
 	free(pl.str.s);
 	if (pl.fp_split) fclose(pl.fp_split);
 	for (i = 0; i < pl.n_fp; ++i)
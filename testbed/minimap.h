@@ -36,12 +36,17 @@
 #define MM_F_PAF_NO_HIT    0x8000000 // output unmapped reads to PAF
 #define MM_F_NO_END_FLT    0x10000000
 #define MM_F_HARD_MLEVEL   0x20000000
+#define MM_F_NUMA          0x40000000 // replicate the index per NUMA node and pin mapping threads; requires HAVE_NUMA
 
 #define MM_I_HPC          0x1
 #define MM_I_NO_SEQ       0x2
 #define MM_I_NO_NAME      0x4
+#define MM_I_FLAT         0x8 // dump the index in the flat format that is mmap()ed on loading
+#define MM_I_PACK         0x10 // delta-encode occurrence lists in memory with mm_idx_pack()
+#define MM_I_BLOOM        0x20 // keep a Bloom filter of minimizers in the index to reject absent ones
 
 #define MM_IDX_MAGIC   "MMI\2"
+#define MM_IDX_MAGIC_FLAT "MMI\3"
 
 #define MM_MAX_SEG       255
 
@@ -68,6 +73,10 @@ typedef struct {
 	uint32_t *S;               // 4-bit packed sequence
 	struct mm_idx_bucket_s *B; // index (hidden)
 	void *km, *h;
+	void *mm;                  // mmap()ed region of a flat index; NULL if the index is on the heap
+	uint64_t mm_len;           // length of _mm_
+	uint64_t *bf, n_bf;        // blocked Bloom filter of minimizers and its number of 64-bit words; NULL if absent
+	uint32_t *name_rank;       // rank of each name in the strcmp() order times 2, then ids in that order; by mm_idx_index_name()
 } mm_idx_t;
 
 // minimap2 alignment
@@ -116,7 +125,9 @@ typedef struct {
 	int bw;          // bandwidth
 	int max_gap, max_gap_ref; // break a chain if there are no minimizers in a max_gap window
 	int max_frag_len;
-	int max_chain_skip;
+	int max_chain_skip;  // stop looking back after this many predecessors already on a chain; 0 to disable
+	int max_chain_iter;  // max number of predecessors looked back at for each anchor
+	int chain_n_threads; // threads chaining independent blocks of anchors of one query; 1 to disable
 	int min_cnt;         // min number of minimizers on each chain
 	int min_chain_score; // min chaining score
 
@@ -135,6 +146,8 @@ typedef struct {
 	int end_bonus;
 	int min_dp_max;  // drop an alignment if the score of the max scoring segment is below this threshold
 	int min_ksw_len;
+	int aln_n_threads; // threads aligning regions and long gaps of one query; 1 to disable
+	float max_wfa_div; // fill gaps with WFA in alignments with estimated divergence below this; 0 to disable
 	int anchor_ext_len, anchor_ext_shift;
 	float max_clip_ratio; // drop an alignment if BOTH ends are clipped above this ratio
 
@@ -159,6 +172,7 @@ typedef struct {
 	int64_t idx_size;
 	mm_idxopt_t opt;
 	FILE *fp_out;
+	const char *fn_add; // if not NULL, sequences appended to the last part of a prebuilt index
 	union {
 		struct mm_bseq_file_s *seq;
 		FILE *idx;
@@ -249,7 +263,8 @@ int64_t mm_idx_is_idx(const char *fn);
  *
  * Given a uni-part index, this function loads the entire index into memory.
  * Given a multi-part index, it loads one part only and places the file pointer
- * at the end of that part.
+ * at the end of that part. A part in the flat format is mmap()ed read-only
+ * instead of being read.
  *
  * @param fp         pointer to FILE object
  *
@@ -265,6 +280,60 @@ mm_idx_t *mm_idx_load(FILE *fp);
  */
 void mm_idx_dump(FILE *fp, const mm_idx_t *mi);
 
+/**
+ * Append an index (or one part of a full index) to file in the flat format
+ *
+ * Buckets are written as open-addressing hash tables and position arrays with
+ * file-relative offsets, so that mm_idx_load() can mmap() the part read-only
+ * and use it in place.
+ *
+ * @param fp         pointer to FILE object
+ * @param mi         minimap2 index
+ */
+void mm_idx_dump_flat(FILE *fp, const mm_idx_t *mi);
+
+/**
+ * Delta-encode the occurrence lists of minimizers appearing more than once
+ *
+ * Lists are decoded on lookup into a thread-local buffer. A packed index can't
+ * be dumped; an mmap()ed index is left unchanged.
+ *
+ * @param mi         minimap2 index
+ * @param n_threads  number of threads
+ */
+void mm_idx_pack(mm_idx_t *mi, int n_threads);
+
+/**
+ * Build the Bloom filter of minimizers
+ *
+ * The filter takes 16 bits per distinct minimizer. It lets a lookup of an
+ * absent minimizer, which is the most common case with noisy reads, read one
+ * 64-bit word instead of probing the bucket. It sets MM_I_BLOOM in mi->flag.
+ * The filter is saved in the flat format; for the default format, only the
+ * flag is saved and the filter is rebuilt on loading. An mmap()ed index is
+ * left unchanged.
+ *
+ * @param mi         minimap2 index
+ * @param n_threads  number of threads
+ */
+void mm_idx_bloom(mm_idx_t *mi, int n_threads);
+
+/**
+ * Append sequences to an index
+ *
+ * Only the new sequences are sketched. Their minimizers are merged into the
+ * affected buckets, so the index is the same as one built from the old and the
+ * new sequences in one part. An mmap()ed index is copied to memory first.
+ *
+ * @param mi               minimap2 index; not packed by mm_idx_pack()
+ * @param fn               fasta/fastq file name
+ * @param mini_batch_size  number of bases read and sketched at a time
+ * @param n_threads        number of threads
+ *
+ * @return number of sequences appended; -1 if _mi_ is packed or _fn_ can't be opened
+ */
+int mm_idx_append(mm_idx_t *mi, const char *fn, int mini_batch_size, int n_threads);
+
 /**
  * Create an index from strings in memory
  *
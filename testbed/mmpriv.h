@@ -12,6 +12,7 @@
 #define MM_DBG_PRINT_QNAME   0x2
 #define MM_DBG_PRINT_SEED    0x4
 #define MM_DBG_PRINT_ALN_SEQ 0x8
+#define MM_DBG_CHECK_GAP     0x10
 
 #define MM_SEED_LONG_JOIN  (1ULL<<40)
 #define MM_SEED_IGNORE     (1ULL<<41)
@@ -49,6 +50,17 @@ typedef struct {
 	mm128_t *a;
 } mm_seg_t;
 
+// Anchors in the SoA layout, from seeding to chaining. Anchor i corresponds to
+// mm128_t {x: tag<<32|x, y: seg<<48|flag<<40|w<<32|y}; see MM_SEED_* for flag.
+typedef struct {
+	int64_t n;
+	uint32_t *tag;  // strand<<31 | rid
+	int32_t *x, *y; // reference and query positions of the last base
+	uint8_t *w;     // span
+	uint8_t *flag;  // MM_SEED_* flags, shifted right by 40
+	uint8_t *seg;   // segment ID
+} mm_anchors_t;
+
 double cputime(void);
 double realtime(void);
 long peakrss(void);
@@ -57,7 +69,10 @@ void radix_sort_128x(mm128_t *beg, mm128_t *end);
 void radix_sort_64(uint64_t *beg, uint64_t *end);
 uint32_t ks_ksmall_uint32_t(size_t n, uint32_t arr[], size_t kk);
 
+struct sdust_buf_s;
+
 void mm_sketch(void *km, const char *str, int len, int w, int k, uint32_t rid, int is_hpc, mm128_v *p);
+void mm_sketch_batch(void *km, int n_seq, const char **seqs, const int *lens, uint32_t rid, int w, int k, int is_hpc, int sdust_thres, struct sdust_buf_s *sdb, mm128_v *p, size_t *off);
 
 void mm_write_sam_hdr(const mm_idx_t *mi, const char *rg, const char *ver, int argc, char *argv[]);
 void mm_write_paf(kstring_t *s, const mm_idx_t *mi, const mm_bseq1_t *t, const mm_reg1_t *r, void *km, int opt_flag);
@@ -65,9 +80,12 @@ void mm_write_sam(kstring_t *s, const mm_idx_t *mi, const mm_bseq1_t *t, const m
 void mm_write_sam2(kstring_t *s, const mm_idx_t *mi, const mm_bseq1_t *t, int seg_idx, int reg_idx, int n_seg, const int *n_regs, const mm_reg1_t *const* regs, void *km, int opt_flag);
 
 void mm_idxopt_init(mm_idxopt_t *opt);
-const uint64_t *mm_idx_get(const mm_idx_t *mi, uint64_t minier, int *n);
+const uint64_t *mm_idx_get(const mm_idx_t *mi, uint64_t minier, int *n, void *km, uint64_t **buf);
+mm_idx_t *mm_idx_dup(const mm_idx_t *mi);
+uint32_t mm_idx_name_rank(const mm_idx_t *mi, const char *name); // the rank of _name_ among the sequence names; odd if absent
+void mm_idx_get_batch(const mm_idx_t *mi, int n, const mm128_t *a, int max_occ, const uint64_t **cr, int *n_occ, void *km, uint64_t **buf);
 int32_t mm_idx_cal_max_occ(const mm_idx_t *mi, float f);
-mm128_t *mm_chain_dp(int max_dist_x, int max_dist_y, int bw, int max_skip, int min_cnt, int min_sc, int is_cdna, int n_segs, int64_t n, mm128_t *a, int *n_u_, uint64_t **_u, void *km, mm_mapopt_t *opt);
+mm128_t *mm_chain_dp(int max_dist_x, int max_dist_y, int bw, int max_skip, int max_iter, int min_cnt, int min_sc, int is_cdna, int n_segs, mm_anchors_t *a, int *n_u_, uint64_t **_u, void *km, mm_mapopt_t *opt);
 mm_reg1_t *mm_align_skeleton(void *km, mm_mapopt_t *opt, const mm_idx_t *mi, int qlen, const char *qstr, int *n_regs_, mm_reg1_t *regs, mm128_t *a);
 
 mm_reg1_t *mm_gen_regs(void *km, uint32_t hash, int qlen, int n_u, uint64_t *u, mm128_t *a);
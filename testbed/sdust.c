@@ -16,6 +16,13 @@ typedef struct {
 } perf_intv_t;
 
 typedef kvec_t(perf_intv_t) perf_intv_v;
+
+typedef struct {
+	int j; // insertion position in the list of perfect intervals before any insertion
+	perf_intv_t p;
+} perf_ins_t;
+
+typedef kvec_t(perf_ins_t) perf_ins_v;
 typedef kvec_t(uint64_t) uint64_v;
 
 KDQ_INIT(int)
@@ -46,6 +53,7 @@ extern unsigned char seq_nt4_table[256];
 struct sdust_buf_s {
 	kdq_t(int) *w;
 	perf_intv_v P; // the list of perfect intervals for the current window, sorted by descending start and then by ascending finish
+	perf_ins_v Q;  // perfect intervals to be inserted to P by find_perfect()
 	uint64_v res;  // the result
 	void *km;      // memory pool
 };
@@ -64,7 +72,7 @@ void sdust_buf_destroy(sdust_buf_t *buf)
 {
 	if (buf == 0) return;
 	kdq_destroy(int, buf->w);
-	kfree(buf->km, buf->P.a); kfree(buf->km, buf->res.a); kfree(buf->km, buf);
+	kfree(buf->km, buf->P.a); kfree(buf->km, buf->Q.a); kfree(buf->km, buf->res.a); kfree(buf->km, buf);
 }
 
 static inline void shift_window(int t, kdq_t(int) *w, int T, int W, int *L, int *rw, int *rv, int *cw, int *cv)
@@ -105,30 +113,41 @@ static inline void save_masked_regions(void *km, uint64_v *res, perf_intv_v *P,
 	P->n = i + 1;
 }
 
-static void find_perfect(void *km, perf_intv_v *P, const kdq_t(int) *w, int T, int start, int L, int rv, const int *cv)
+static void find_perfect(void *km, perf_intv_v *P, perf_ins_v *Q, const kdq_t(int) *w, int T, int start, int L, int rv, const int *cv)
 {
-	int c[SD_WTOT], r = rv, i, max_r = 0, max_l = 0;
+	int c[SD_WTOT], r = rv, i, j = 0, k, e, max_r = 0, max_l = 0;
 	memcpy(c, cv, SD_WTOT * sizeof(int));
+	Q->n = 0;
 	for (i = (long)kdq_size(w) - L - 1; i >= 0; --i) {
-		int j, t = kdq_at(w, i), new_r, new_l;
+		int t = kdq_at(w, i), new_r, new_l;
 		r += c[t]++;
 		new_r = r, new_l = kdq_size(w) - i - 1;
 		if (new_r * 10 > T * new_l) {
-			for (j = 0; j < (int)P->n && P->a[j].start >= i + start; ++j) { // find insertion position
+			// as i decreases, the insertion position only moves forward; new intervals never raise the max over earlier ones
+			for (; j < (int)P->n && P->a[j].start >= i + start; ++j) { // find insertion position
 				perf_intv_t *p = &P->a[j];
 				if (max_r == 0 || p->r * max_l > max_r * p->l)
 					max_r = p->r, max_l = p->l;
 			}
 			if (max_r == 0 || new_r * max_l >= max_r * new_l) { // then insert
+				perf_ins_t *q;
 				max_r = new_r, max_l = new_l;
-				if (P->n == P->m) kv_resize(perf_intv_t, km, *P, P->n + 1);
-				memmove(&P->a[j+1], &P->a[j], (P->n - j) * sizeof(perf_intv_t)); // make room
-				++P->n;
-				P->a[j].start = i + start, P->a[j].finish = kdq_size(w) + (SD_WLEN - 1) + start;
-				P->a[j].r = new_r, P->a[j].l = new_l;
+				kv_pushp(perf_ins_t, km, *Q, &q);
+				q->j = j;
+				q->p.start = i + start, q->p.finish = kdq_size(w) + (SD_WLEN - 1) + start;
+				q->p.r = new_r, q->p.l = new_l;
 			}
 		}
 	}
+	if (Q->n == 0) return;
+	if (P->n + Q->n > P->m) kv_resize(perf_intv_t, km, *P, P->n + Q->n);
+	for (k = (int)Q->n - 1, e = P->n; k >= 0; --k) { // insert from the end so that each interval is moved at most once
+		perf_ins_t *q = &Q->a[k];
+		memmove(&P->a[q->j + k + 1], &P->a[q->j], (e - q->j) * sizeof(perf_intv_t));
+		P->a[q->j + k] = q->p;
+		e = q->j;
+	}
+	P->n += Q->n;
 }
 
 const uint64_t *sdust_core(const uint8_t *seq, int l_seq, int T, int W, int *n, sdust_buf_t *buf)
@@ -151,7 +170,7 @@ const uint64_t *sdust_core(const uint8_t *seq, int l_seq, int T, int W, int *n,
 				save_masked_regions(buf->km, &buf->res, &buf->P, start); // save intervals falling out of the current window?
 				shift_window(t, buf->w, T, W, &L, &rw, &rv, cw, cv);
 				if (rw * 10 > L * T)
-					find_perfect(buf->km, &buf->P, buf->w, T, start, L, rv, cv);
+					find_perfect(buf->km, &buf->P, &buf->Q, buf->w, T, start, L, rv, cv);
 			}
 		} else { // N or the end of sequence; N effectively breaks input into pieces of independent sequences
 			start = (l - W + 1 > 0? l - W + 1 : 0) + (i + 1 - l);
@@ -4,6 +4,7 @@
 #include <string.h>
 #define __STDC_LIMIT_MACROS
 #include "kvec.h"
+#include "sdust.h"
 #include "mmpriv.h"
 
 unsigned char seq_nt4_table[256] = {
@@ -57,6 +58,46 @@ static inline int tq_shift(tiny_queue_t *q)
 	return x;
 }
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+
+static inline __m128i hash64_sse2(__m128i key, __m128i mask) // hash64() on two keys
+{
+	key = _mm_and_si128(_mm_add_epi64(_mm_xor_si128(key, _mm_set1_epi32(-1)), _mm_slli_epi64(key, 21)), mask);
+	key = _mm_xor_si128(key, _mm_srli_epi64(key, 24));
+	key = _mm_and_si128(_mm_add_epi64(_mm_add_epi64(key, _mm_slli_epi64(key, 3)), _mm_slli_epi64(key, 8)), mask);
+	key = _mm_xor_si128(key, _mm_srli_epi64(key, 14));
+	key = _mm_and_si128(_mm_add_epi64(_mm_add_epi64(key, _mm_slli_epi64(key, 2)), _mm_slli_epi64(key, 4)), mask);
+	key = _mm_xor_si128(key, _mm_srli_epi64(key, 28));
+	key = _mm_and_si128(_mm_add_epi64(key, _mm_slli_epi64(key, 31)), mask);
+	return key;
+}
+#endif
+
+static void hash64_span(int n, uint64_t *x, uint64_t mask) // x[i] = hash64(x[i]>>8)<<8 | (x[i]&0xff)
+{
+	int i = 0;
+#ifdef __SSE2__
+	__m128i m = _mm_set1_epi64x(mask), lo = _mm_set1_epi64x(0xff);
+	for (; i + 2 <= n; i += 2) {
+		__m128i v = _mm_loadu_si128((__m128i*)&x[i]);
+		__m128i h = hash64_sse2(_mm_srli_epi64(v, 8), m);
+		_mm_storeu_si128((__m128i*)&x[i], _mm_or_si128(_mm_slli_epi64(h, 8), _mm_and_si128(v, lo)));
+	}
+#endif
+	for (; i < n; ++i)
+		x[i] = hash64(x[i]>>8, mask) << 8 | (x[i]&0xff);
+}
+
+#define MM_SKETCH_BLK 256 // number of positions whose k-mers are hashed together
+
+static inline void sketch_push(void *km, mm128_v *p, uint64_t x, uint64_t y)
+{
+	mm128_t t;
+	t.x = x, t.y = y;
+	kv_push(mm128_t, km, *p, t);
+}
+
 /**
  * Find symmetric (w,k)-minimizers on a DNA sequence
  *
@@ -76,23 +117,45 @@ static inline int tq_shift(tiny_queue_t *q)
  */
 void mm_sketch(void *km, const char *str, int len, int w, int k, uint32_t rid, int is_hpc, mm128_v *p)
 {
-	uint64_t shift1 = 2 * (k - 1), mask = (1ULL<<2*k) - 1, kmer[2] = {0,0};
-	int i, j, l, buf_pos, min_pos, kmer_span = 0;
-	mm128_t buf[256], min = { UINT64_MAX, UINT64_MAX };
+	uint64_t shift1 = 2 * (k - 1), mask = (1ULL<<2*k) - 1, kf = 0, kr = 0; // forward and reverse k-mers
+	uint64_t bx[512], by[512], min_x = UINT64_MAX, min_y = UINT64_MAX; // the window; kept in two arrays for fast scanning
+	uint64_t hx[MM_SKETCH_BLK], hy[MM_SKETCH_BLK];
+	int32_t hl[MM_SKETCH_BLK]; // l at each position; negative if the position has no valid k-mer
+	int i, j, l, n, t, buf_pos, min_pos, kmer_span = 0;
 	tiny_queue_t tq;
 
 	assert(len > 0 && (w > 0 && w < 256) && (k > 0 && k <= 28)); // 56 bits for k-mer; could use long k-mers, but 28 enough in practice
-	memset(buf, 0xff, w * 16);
+	memset(bx, 0xff, w * 16);
+	memset(by, 0xff, w * 16);
 	memset(&tq, 0, sizeof(tiny_queue_t));
 	kv_resize(mm128_t, km, *p, p->n + len/w);
 
-	for (i = l = buf_pos = min_pos = 0; i < len; ++i) {
-		int c = seq_nt4_table[(uint8_t)str[i]];
-		mm128_t info = { UINT64_MAX, UINT64_MAX };
-		if (c < 4) { // not an ambiguous base
-			int z;
-			if (is_hpc) {
-				int skip_len = 1;
+	for (i = l = buf_pos = min_pos = 0; i < len;) {
+		// collect up to MM_SKETCH_BLK k-mers; symmetric k-mers are skipped as we don't know their strand
+		if (!is_hpc) { // the common case; kmer_span is min(l+1,k)
+			for (n = 0; n < MM_SKETCH_BLK && i < len; ++i) {
+				int c = seq_nt4_table[(uint8_t)str[i]], z;
+				if (c >= 4) { // an ambiguous base
+					l = 0, hx[n] = 0, hl[n++] = -1;
+					continue;
+				}
+				kf = (kf << 2 | c) & mask;
+				kr = (kr >> 2) | (3ULL^c) << shift1;
+				if (kf == kr) continue;
+				z = kf < kr? 0 : 1; // strand
+				hx[n] = (z? kr : kf) << 8 | (l + 1 < k? l + 1 : k);
+				hy[n] = (uint64_t)rid<<32 | (uint32_t)i<<1 | z;
+				++l;
+				hl[n++] = l >= k? l : -1 - l;
+			}
+		} else {
+			for (n = 0; n < MM_SKETCH_BLK && i < len; ++i) {
+				int c = seq_nt4_table[(uint8_t)str[i]], z, skip_len = 1;
+				if (c >= 4) {
+					l = 0, tq.count = tq.front = 0, kmer_span = 0;
+					hx[n] = 0, hl[n++] = -1;
+					continue;
+				}
 				if (i + 1 < len && seq_nt4_table[(uint8_t)str[i + 1]] == c) {
 					for (skip_len = 2; i + skip_len < len; ++skip_len)
 						if (seq_nt4_table[(uint8_t)str[i + skip_len]] != c)
@@ -102,42 +165,108 @@ void mm_sketch(void *km, const char *str, int len, int w, int k, uint32_t rid, i
 				tq_push(&tq, skip_len);
 				kmer_span += skip_len;
 				if (tq.count > k) kmer_span -= tq_shift(&tq);
-			} else kmer_span = l + 1 < k? l + 1 : k;
-			kmer[0] = (kmer[0] << 2 | c) & mask;           // forward k-mer
-			kmer[1] = (kmer[1] >> 2) | (3ULL^c) << shift1; // reverse k-mer
-			if (kmer[0] == kmer[1]) continue; // skip "symmetric k-mers" as we don't know it strand
-			z = kmer[0] < kmer[1]? 0 : 1; // strand
-			++l;
-			if (l >= k && kmer_span < 256) {
-				info.x = hash64(kmer[z], mask) << 8 | kmer_span;
-				info.y = (uint64_t)rid<<32 | (uint32_t)i<<1 | z;
+				kf = (kf << 2 | c) & mask;
+				kr = (kr >> 2) | (3ULL^c) << shift1;
+				if (kf == kr) continue;
+				z = kf < kr? 0 : 1;
+				++l;
+				hx[n] = (z? kr : kf) << 8 | (kmer_span & 0xff);
+				hy[n] = (uint64_t)rid<<32 | (uint32_t)i<<1 | z;
+				hl[n++] = l >= k && kmer_span < 256? l : -1 - l;
 			}
-		} else l = 0, tq.count = tq.front = 0, kmer_span = 0;
-		buf[buf_pos] = info; // need to do this here as appropriate buf_pos and buf[buf_pos] are needed below
-		if (l == w + k - 1 && min.x != UINT64_MAX) { // special case for the first window - because identical k-mers are not stored yet
-			for (j = buf_pos + 1; j < w; ++j)
-				if (min.x == buf[j].x && buf[j].y != min.y) kv_push(mm128_t, km, *p, buf[j]);
-			for (j = 0; j < buf_pos; ++j)
-				if (min.x == buf[j].x && buf[j].y != min.y) kv_push(mm128_t, km, *p, buf[j]);
 		}
-		if (info.x <= min.x) { // a new minimum; then write the old min
-			if (l >= w + k && min.x != UINT64_MAX) kv_push(mm128_t, km, *p, min);
-			min = info, min_pos = buf_pos;
-		} else if (buf_pos == min_pos) { // old min has moved outside the window
-			if (l >= w + k - 1 && min.x != UINT64_MAX) kv_push(mm128_t, km, *p, min);
-			for (j = buf_pos + 1, min.x = UINT64_MAX; j < w; ++j) // the two loops are necessary when there are identical k-mers
-				if (min.x >= buf[j].x) min = buf[j], min_pos = j; // >= is important s.t. min is always the closest k-mer
-			for (j = 0; j <= buf_pos; ++j)
-				if (min.x >= buf[j].x) min = buf[j], min_pos = j;
-			if (l >= w + k - 1 && min.x != UINT64_MAX) { // write identical k-mers
-				for (j = buf_pos + 1; j < w; ++j) // these two loops make sure the output is sorted
-					if (min.x == buf[j].x && min.y != buf[j].y) kv_push(mm128_t, km, *p, buf[j]);
-				for (j = 0; j <= buf_pos; ++j)
-					if (min.x == buf[j].x && min.y != buf[j].y) kv_push(mm128_t, km, *p, buf[j]);
+		hash64_span(n, hx, mask);
+
+		// find minimizers in the sliding window; entries are mirrored at bx[j] and bx[j+w] so that the window is contiguous
+		for (t = 0; t < n; ++t) {
+			uint64_t x = UINT64_MAX, y = UINT64_MAX;
+			l = hl[t] >= 0? hl[t] : -1 - hl[t];
+			if (hl[t] >= 0) x = hx[t], y = hy[t];
+			bx[buf_pos] = bx[buf_pos + w] = x, by[buf_pos] = by[buf_pos + w] = y;
+			if (l == w + k - 1 && min_x != UINT64_MAX) { // special case for the first window - because identical k-mers are not stored yet
+				for (j = buf_pos + 1; j < buf_pos + w; ++j)
+					if (min_x == bx[j] && by[j] != min_y) sketch_push(km, p, bx[j], by[j]);
 			}
+			if (x <= min_x) { // a new minimum; then write the old min
+				if (l >= w + k && min_x != UINT64_MAX) sketch_push(km, p, min_x, min_y);
+				min_x = x, min_y = y, min_pos = buf_pos;
+			} else if (buf_pos == min_pos) { // old min has moved outside the window
+				uint64_t m = UINT64_MAX;
+				int dup = 0;
+				if (l >= w + k - 1 && min_x != UINT64_MAX) sketch_push(km, p, min_x, min_y);
+				for (j = buf_pos + 1; j <= buf_pos + w; ++j) { // the closest of identical k-mers is the min
+					dup = bx[j] < m? 0 : dup | (bx[j] == m);
+					if (m >= bx[j]) m = bx[j], min_pos = j;
+				}
+				if (min_pos >= w) min_pos -= w;
+				min_x = m, min_y = by[min_pos];
+				if (dup && l >= w + k - 1 && min_x != UINT64_MAX) { // write identical k-mers in order
+					for (j = buf_pos + 1; j <= buf_pos + w; ++j)
+						if (min_x == bx[j] && min_y != by[j]) sketch_push(km, p, bx[j], by[j]);
+				}
+			}
+			if (++buf_pos == w) buf_pos = 0;
 		}
-		if (++buf_pos == w) buf_pos = 0;
 	}
-	if (min.x != UINT64_MAX)
-		kv_push(mm128_t, km, *p, min);
+	if (min_x != UINT64_MAX)
+		sketch_push(km, p, min_x, min_y);
+}
+
+static int sketch_dust(int n, mm128_t *a, int l_seq, const char *seq, int sdust_thres, sdust_buf_t *sdb)
+{
+	int n_dreg, j, k, u = 0;
+	const uint64_t *dreg;
+	dreg = sdust_core((const uint8_t*)seq, l_seq, sdust_thres, 64, &n_dreg, sdb);
+	for (j = k = 0; j < n; ++j) { // squeeze out minimizers that significantly overlap with LCRs
+		int32_t qpos = (uint32_t)a[j].y>>1, span = a[j].x&0xff;
+		int32_t s = qpos - (span - 1), e = s + span;
+		while (u < n_dreg && (int32_t)dreg[u] <= s) ++u;
+		if (u < n_dreg && (int32_t)(dreg[u]>>32) < e) {
+			int v, l = 0;
+			for (v = u; v < n_dreg && (int32_t)(dreg[v]>>32) < e; ++v) { // iterate over LCRs overlapping this minimizer
+				int ss = s > (int32_t)(dreg[v]>>32)? s : dreg[v]>>32;
+				int ee = e < (int32_t)dreg[v]? e : (uint32_t)dreg[v];
+				l += ee - ss;
+			}
+			if (l <= span>>1) a[k++] = a[j]; // keep the minimizer if less than half of it falls in masked region
+		} else a[k++] = a[j];
+	}
+	return k; // the new size
+}
+
+/**
+ * Find minimizers on a batch of sequences
+ *
+ * The output is the concatenation of mm_sketch() on each sequence, optionally
+ * followed by SDUST masking. $p is grown once for the whole batch and a single
+ * SDUST buffer is shared by all sequences.
+ *
+ * @param n_seq       number of sequences
+ * @param seqs        DNA sequences; empty sequences are skipped
+ * @param lens        lengths of $seqs
+ * @param rid         reference ID of the first sequence; the i-th sequence gets $rid+i
+ * @param sdust_thres SDUST score threshold; 0 to disable masking
+ * @param sdb         SDUST buffer to reuse across calls; if NULL, a temporary buffer is allocated from $km
+ * @param off         if not NULL, the minimizers of the i-th sequence are p->a[off[i]] to p->a[off[i+1]-1]; of size $n_seq+1
+ */
+void mm_sketch_batch(void *km, int n_seq, const char **seqs, const int *lens, uint32_t rid, int w, int k, int is_hpc, int sdust_thres, sdust_buf_t *sdb, mm128_v *p, size_t *off)
+{
+	int i;
+	size_t sum_len = 0;
+	sdust_buf_t *tmp = 0;
+	for (i = 0; i < n_seq; ++i)
+		sum_len += lens[i] > 0? lens[i] : 0;
+	kv_resize(mm128_t, km, *p, p->n + sum_len * 2 / (w + 1) + n_seq); // expected density of random minimizers is 2/(w+1)
+	if (sdust_thres > 0 && sdb == 0) sdb = tmp = sdust_buf_init(km);
+	else if (sdust_thres <= 0) sdb = 0;
+	for (i = 0; i < n_seq; ++i) {
+		size_t n = p->n;
+		if (off) off[i] = n;
+		if (lens[i] <= 0) continue;
+		mm_sketch(km, seqs[i], lens[i], w, k, rid + i, is_hpc, p);
+		if (sdb) // mask low-complexity minimizers
+			p->n = n + sketch_dust(p->n - n, p->a + n, lens[i], seqs[i], sdust_thres, sdb);
+	}
+	if (off) off[n_seq] = p->n;
+	sdust_buf_destroy(tmp);
 }